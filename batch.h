@@ -0,0 +1,152 @@
+// Batch mode shared by the solvers: queries are read one per line,
+// solved on a fixed pool of threads, and their results written in
+// input order.
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <cstdlib>
+
+#include "knight.h"
+#include "output.h"
+#include "stats.h"
+
+// Answers a query with the text of its result. Each thread has its own
+// Worker, which keeps the thread's preallocated search state.
+typedef std::function<void(const std::vector<int>&, std::string&)> Worker;
+
+// Append value to out, with a sign if showpos is set.
+inline void appendInt(int value, bool showpos, std::string& out) {
+  char buffer[12];
+  out.append(buffer, formatInt(value, showpos, buffer) - buffer);
+}
+
+// Append moves to out, one per line as the solvers print them.
+inline void appendMoveLines(const std::vector<Vec2>& moves, std::string& out) {
+  for (auto move : moves) {
+    appendInt(move.x_, true, out);
+    out += '\t';
+    appendInt(move.y_, true, out);
+    out += '\n';
+  }
+}
+
+// Parse the integers of line into values. Return false if there is
+// none.
+inline bool parseInts(const std::string& line, std::vector<int>& values) {
+  values.clear();
+  const char* p = line.c_str();
+  for (char* end;; p = end) {
+    const long value = std::strtol(p, &end, 10);
+    if (end == p) break;
+    values.push_back(value);
+  }
+  return !values.empty();
+}
+
+// Solve the queries read one per line from `from` on numThreads
+// threads, each with a worker made by makeWorker, and write each
+// result to `to` followed by an empty line, in input order. Empty
+// lines are skipped.
+//
+// Queries go through a ring of slots, a reorder buffer: the reading
+// thread fills the slots in order, workers take the next filled slot,
+// and the reading thread writes the results as soon as all earlier
+// ones are written. The slots keep their buffers, so after warm-up no
+// query allocates.
+inline void runBatch(std::istream& from, std::ostream& to, int numThreads,
+                     std::function<Worker()> makeWorker) {
+  struct Slot {
+    std::vector<int> query_;
+    std::string result_;
+    bool done_;
+  };
+  numThreads = std::max(numThreads, 1);
+  std::vector<Slot> slots(64 * numThreads);
+  const size_t capacity = slots.size();
+
+  std::mutex mutex;
+  std::condition_variable filled, solved;
+  size_t numRead = 0, numTaken = 0, numWritten = 0;
+  bool eof = false;
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < numThreads; ++i) {
+    workers.push_back(std::thread([&](Worker worker) {
+      std::unique_lock<std::mutex> lock(mutex);
+      for (;;) {
+        filled.wait(lock, [&]() { return numTaken < numRead || eof; });
+        if (numTaken == numRead) return;
+
+        Slot& slot = slots[numTaken++ % capacity];
+        lock.unlock();
+        slot.result_.clear();
+        try {
+          worker(slot.query_, slot.result_);
+        } catch (const std::exception&) {
+          // E.g. a board with no cells.
+          slot.result_ = "BAD_REQUEST\n";
+        }
+        slot.result_ += '\n';
+        lock.lock();
+        slot.done_ = true;
+        solved.notify_one();
+      }
+    }, makeWorker()));
+  }
+
+  // Write the results that are solved, in order. With wait set, wait
+  // for the first one. Called with the lock held.
+  std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+  auto writeSolved = [&](bool wait) {
+    while (numWritten < numRead) {
+      Slot& slot = slots[numWritten % capacity];
+      if (wait) solved.wait(lock, [&]() { return slot.done_; });
+      if (!slot.done_) return;
+
+      // The slot is not reused before numWritten moves past it.
+      lock.unlock();
+      {
+        STATS_PHASE(PRINT);
+        to.write(slot.result_.data(), slot.result_.size());
+      }
+      lock.lock();
+      ++numWritten;
+      wait = false;
+    }
+  };
+
+  std::string line;
+  std::vector<int> query;
+  for (;;) {
+    {
+      STATS_PHASE(PARSE);
+      if (!std::getline(from, line)) break;
+      if (!parseInts(line, query)) continue;
+    }
+
+    lock.lock();
+    if (numRead - numWritten == capacity) writeSolved(true);
+    Slot& slot = slots[numRead++ % capacity];
+    slot.query_.swap(query);
+    slot.done_ = false;
+    filled.notify_one();
+    writeSolved(false);
+    lock.unlock();
+  }
+
+  lock.lock();
+  eof = true;
+  filled.notify_all();
+  while (numWritten < numRead) writeSolved(true);
+  lock.unlock();
+  for (auto& worker : workers) worker.join();
+}
+
+#endif // BATCH_H
@@ -0,0 +1,70 @@
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <ios>
+#include <thread>
+
+#include "server.h"
+
+// A small client of the solver servers (l2, l3 and l4 --serve), for
+// testing. Reads one request per line from stdin, sends them all
+// without waiting for the responses, and prints the responses in
+// order.
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <socket>\n";
+    return 2;
+  }
+  const int fd = connectTo(argv[1]);
+
+  // Send from a separate thread, so the server never blocks on
+  // responses nobody reads.
+  std::thread sender([fd]() {
+    std::string line, out;
+    std::vector<int> request;
+    while (std::getline(std::cin, line)) {
+      std::stringstream iss(line);
+      int value;
+      request.clear();
+      while (iss >> value) request.push_back(value);
+      if (request.empty()) continue;
+
+      appendFrame(request, out);
+      if (out.size() >= (1 << 16)) {
+        writeAll(fd, out);
+        out.clear();
+      }
+    }
+    writeAll(fd, out);
+    shutdown(fd, SHUT_WR);
+  });
+
+  std::string in;
+  std::vector<int> response;
+  char buffer[1 << 16];
+  for (;;) {
+    const ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n <= 0) break;
+    in.append(buffer, n);
+
+    const char* p = in.data();
+    while (parseFrame(p, in.data() + in.size(), response)) {
+      if (response.empty() || response[0] == BAD_REQUEST) {
+        std::cout << "BAD_REQUEST\n";
+      } else if (response[0] == TIMEOUT) {
+        std::cout << "TIMEOUT\n";
+      } else if (response[0] == NO_PATH) {
+        std::cout << "NO_PATH\n";
+      } else {
+        std::cout << std::noshowpos << response[0] << "\n" << std::showpos;
+        for (size_t i = 1; i + 1 < response.size(); i += 2) {
+          std::cout << response[i] << "\t" << response[i + 1] << "\n";
+        }
+      }
+    }
+    in.erase(0, p - in.data());
+  }
+  sender.join();
+  close(fd);
+}
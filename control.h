@@ -0,0 +1,204 @@
+// Control of long running searches: cancellation, deadlines and
+// progress, and a small executor running searches in the background
+// behind future handles.
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdlib>
+
+// Thrown out of a search that was cancelled or ran past its deadline.
+// The search state is released as the exception unwinds.
+class SearchCancelled : public std::runtime_error {
+ public:
+  SearchCancelled(): std::runtime_error("Search cancelled.") {}
+};
+
+// Shared by a search and the code waiting for it. The search calls
+// tick() once per step (a vertex expanded), which costs a decrement:
+// only every INTERVAL steps does it look at the cancel flag and the
+// clock, and report progress.
+class SearchControl {
+ public:
+  typedef std::chrono::steady_clock Clock;
+  // Called from the searching thread with the number of steps so far.
+  typedef std::function<void(uint64_t)> Progress;
+
+  SearchControl(): cancelled_(false), hasDeadline_(false), steps_(0), countdown_(INTERVAL) {}
+
+  // Make the search throw SearchCancelled at its next check. Can be
+  // called from any thread.
+  inline void cancel() { cancelled_ = true; }
+
+  inline bool isCancelled() const { return cancelled_; }
+
+  inline void setDeadline(Clock::time_point deadline) {
+    deadline_ = deadline;
+    hasDeadline_ = true;
+  }
+
+  // Set the deadline timeout milliseconds from now, none if 0.
+  inline void setTimeout(int timeout) {
+    if (timeout > 0) setDeadline(Clock::now() + std::chrono::milliseconds(timeout));
+  }
+
+  inline void setProgress(Progress progress) { progress_ = progress; }
+
+  inline void tick() {
+    if (--countdown_ == 0) check();
+  }
+
+  // Number of steps, counted by INTERVAL.
+  inline uint64_t steps() const { return steps_; }
+
+ private:
+  static const int INTERVAL = 1 << 12;
+  std::atomic<bool> cancelled_;
+  bool hasDeadline_;
+  Clock::time_point deadline_;
+  Progress progress_;
+  uint64_t steps_;
+  int countdown_;
+
+  void check() {
+    countdown_ = INTERVAL;
+    steps_ += INTERVAL;
+    if (cancelled_ || (hasDeadline_ && Clock::now() >= deadline_)) throw SearchCancelled();
+    if (progress_) progress_(steps_);
+  }
+
+}; // class SearchControl
+
+// A fixed pool of threads running tasks in the order they are posted,
+// so many queries can be multiplexed on a few threads. Tasks still
+// queued when the executor is destroyed are dropped.
+class Executor {
+ public:
+  explicit Executor(int numThreads): stopping_(false) {
+    for (int i = 0; i < std::max(numThreads, 1); ++i) {
+      threads_.push_back(std::thread([this]() { run(); }));
+    }
+  }
+
+  ~Executor() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+      tasks_.clear();
+    }
+    posted_.notify_all();
+    for (auto& thread : threads_) thread.join();
+  }
+
+  void post(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(task);
+    }
+    posted_.notify_one();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable posted_;
+  std::deque<std::function<void()> > tasks_;
+  std::vector<std::thread> threads_;
+  bool stopping_;
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      posted_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+      if (stopping_) return;
+      std::function<void()> task = tasks_.front();
+      tasks_.pop_front();
+      lock.unlock();
+      task();
+      lock.lock();
+    }
+  }
+
+}; // class Executor
+
+// The handle of a search submitted to an Executor: a future of its
+// result, polled with isReady or waited for with get, and its control.
+// Destroying a handle whose search has not finished cancels it, so an
+// abandoned query frees its state at the search's next check, or is
+// never started.
+template <typename T>
+class Query {
+ public:
+  Query(std::shared_ptr<SearchControl> control, std::future<T> future):
+      control_(control), future_(std::move(future)) {}
+
+  Query(Query&&) = default;
+  Query& operator=(Query&&) = default;
+
+  ~Query() {
+    if (control_) control_->cancel();
+  }
+
+  inline void cancel() { control_->cancel(); }
+
+  inline bool isReady() const {
+    return future_.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+  }
+
+  // Wait for the result. Throws SearchCancelled if the search was
+  // cancelled or ran past its deadline.
+  T get() { return future_.get(); }
+
+  inline SearchControl& control() { return *control_; }
+
+ private:
+  std::shared_ptr<SearchControl> control_;
+  std::future<T> future_;
+};
+
+// Run search(control) on executor, with a deadline timeout
+// milliseconds from now (none if 0), and return its handle. The search
+// must call control.tick() in its inner loop.
+template <typename T>
+Query<T> submit(Executor& executor, std::function<T(SearchControl&)> search, int timeout = 0,
+                SearchControl::Progress progress = SearchControl::Progress()) {
+  std::shared_ptr<SearchControl> control(new SearchControl);
+  control->setTimeout(timeout);
+  control->setProgress(progress);
+  std::shared_ptr<std::promise<T> > promise(new std::promise<T>);
+  Query<T> query(control, promise->get_future());
+  executor.post([control, promise, search]() {
+    try {
+      if (control->isCancelled()) throw SearchCancelled();
+      promise->set_value(search(*control));
+    } catch (...) {
+      promise->set_exception(std::current_exception());
+    }
+  });
+  return query;
+}
+
+// Remove a leading --deadline <ms> from the command line. Return the
+// timeout in milliseconds, 0 if none.
+inline int parseDeadline(int& argc, char**& argv) {
+  if (argc < 3 || std::string(argv[1]) != "--deadline") return 0;
+  const int timeout = std::atoi(argv[2]);
+  argv[2] = argv[0];
+  argv += 2;
+  argc -= 2;
+  return timeout;
+}
+
+#endif // CONTROL_H
@@ -0,0 +1,21 @@
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iterator>
+
+#include "output.h"
+
+// Decoder of the binary move lists written by the solvers with
+// --binary. Reads records from stdin and prints them as the solvers
+// print text.
+int main() {
+  const std::string in((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+  FdWriter out(STDOUT_FILENO);
+  std::vector<Vec2> moves;
+  for (const char* p = in.data(); p < in.data() + in.size();) {
+    bool withDist;
+    int dist;
+    const bool found = parseBinaryMoves(p, in.data() + in.size(), withDist, dist, moves);
+    writeResult(found, withDist, dist, moves, false, out);
+  }
+}
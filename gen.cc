@@ -0,0 +1,109 @@
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstdlib>
+#include <cstdint>
+
+#include "knight.h"
+
+// Workload generator for the benchmarks. The output only depends on
+// the arguments: the random numbers come from a fixed xorshift64*
+// generator, not from the standard library distributions, which
+// differ between implementations.
+//
+//   gen map <depth> <width> <seed> <W> <R> <B> <T> <L>
+//     A map in level 4 format. W, R, B, T, L are the percentages of
+//     WATER, ROCK, BARRIER, TELEPORT and LAVA cells.
+//   gen queries <depth> <width> <count> <seed> [dims]
+//     Random <startX> <startY> <endX> <endY> queries, one per line,
+//     prefixed with <depth> <width> if dims is 1 (levels 2 and 3).
+//   gen walks <depth> <width> <count> <length> <seed>
+//     Level 1 batch records: random walks of up to length knight moves
+//     that stay on the board.
+
+class Random {
+ public:
+  Random(uint64_t seed): state_(seed * 2685821657736338717ull + 1) {}
+
+  // Return a number in [0, n).
+  int next(int n) {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return (state_ * 2685821657736338717ull >> 33) % n;
+  }
+
+ private:
+  uint64_t state_;
+};
+
+void generateMap(int depth, int width, Random& random, const int percents[5], std::ostream& to) {
+  const char types[5] = { 'W', 'R', 'B', 'T', 'L' };
+  std::string row;
+  for (int y = 0; y < depth; ++y) {
+    row.clear();
+    for (int x = 0; x < width; ++x) {
+      int r = random.next(100);
+      char c = '.';
+      for (int i = 0; i < 5; ++i) {
+        if (r < percents[i]) {
+          c = types[i];
+          break;
+        }
+        r -= percents[i];
+      }
+      if (x > 0) row += ' ';
+      row += c;
+    }
+    to << row << "\n";
+  }
+}
+
+void generateQueries(int depth, int width, int count, Random& random, bool dims,
+                     std::ostream& to) {
+  for (int i = 0; i < count; ++i) {
+    if (dims) to << depth << " " << width << " ";
+    const int startX = random.next(width), startY = random.next(depth);
+    const int endX = random.next(width), endY = random.next(depth);
+    to << startX << " " << startY << " " << endX << " " << endY << "\n";
+  }
+}
+
+void generateWalks(int depth, int width, int count, int length, Random& random,
+                   std::ostream& to) {
+  const Board board(depth, width);
+  for (int i = 0; i < count; ++i) {
+    Vec2 pos(random.next(width), random.next(depth));
+    to << depth << " " << width << " " << pos.x_ << " " << pos.y_;
+    for (int k = 0; k < length; ++k) {
+      const Vec2 move = Knight::move(random.next(Knight::N));
+      if (!board.isInside(pos + move)) continue;
+      pos += move;
+      to << " " << move.x_ << " " << move.y_;
+    }
+    to << "\n";
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::ios::sync_with_stdio(false);
+  const std::string mode = argc >= 2 ? argv[1] : "";
+  std::vector<int> args;
+  for (int i = 2; i < argc; ++i) args.push_back(std::atoi(argv[i]));
+
+  if (mode == "map" && args.size() == 8) {
+    Random random(args[2]);
+    generateMap(args[0], args[1], random, &args[3], std::cout);
+  } else if (mode == "queries" && (args.size() == 4 || args.size() == 5)) {
+    Random random(args[3]);
+    generateQueries(args[0], args[1], args[2], random, args.size() == 5 && args[4], std::cout);
+  } else if (mode == "walks" && args.size() == 5) {
+    Random random(args[4]);
+    generateWalks(args[0], args[1], args[2], args[3], random, std::cout);
+  } else {
+    std::cerr << "Usage: " << argv[0] << " map <depth> <width> <seed> <W> <R> <B> <T> <L>\n";
+    std::cerr << "       " << argv[0] << " queries <depth> <width> <count> <seed> [dims]\n";
+    std::cerr << "       " << argv[0] << " walks <depth> <width> <count> <length> <seed>\n";
+    return 2;
+  }
+}
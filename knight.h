@@ -0,0 +1,424 @@
+// Shared core of the KnightBoard solvers: positions, the move sets of
+// leaper pieces, board geometry and board symmetries.
+#ifndef KNIGHT_H
+#define KNIGHT_H
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <climits>
+#include <cstdint>
+
+// Simple vector class representing position on the board as well as
+// movement.
+struct Vec2 {
+  int x_, y_;
+  Vec2(int x, int y): x_(x), y_(y) {}
+  Vec2(): x_(0), y_(0) {}
+  Vec2& operator+=(const Vec2& other) {
+    x_ += other.x_;
+    y_ += other.y_;
+    return *this;
+  }
+};
+
+inline std::ostream& operator<<(std::ostream& to, const Vec2& v) {
+  return to << "(" << v.x_ << ", " << v.y_ << ")";
+}
+
+// Comparator, used in std::find
+inline bool operator==(const Vec2& v1, const Vec2& v2) {
+  return v1.x_ == v2.x_ && v1.y_ == v2.y_;
+}
+
+inline bool operator!=(const Vec2& v1, const Vec2& v2) {
+  return !(v1 == v2);
+}
+
+// Sum
+inline Vec2 operator+(const Vec2& v1, const Vec2& v2) {
+  return Vec2(v1.x_ + v2.x_, v1.y_ + v2.y_);
+}
+
+// Substract
+inline Vec2 operator-(const Vec2& v1, const Vec2& v2) {
+  return Vec2(v1.x_ - v2.x_, v1.y_ - v2.y_);
+}
+
+// Calls f(I), f(I + 1), ..., f(N - 1) and stops at the first call
+// returning true. The calls are expanded at compile time, so a loop
+// over a piece's moves has no loop counter and constant move indices.
+template <int I, int N>
+struct Unroll {
+  template <typename F>
+  static inline bool any(F& f) {
+    return f(I) || Unroll<I + 1, N>::any(f);
+  }
+};
+
+template <int N>
+struct Unroll<N, N> {
+  template <typename F>
+  static inline bool any(F&) { return false; }
+};
+
+// The move set of a leaper, a piece jumping A squares along one axis
+// and B squares along the other. At any point, a leaper might have 8
+// potential moves. The moves are listed in the order
+// (A, B), (B, A), (B, -A), (A, -B), (-A, B), (-B, A), (-B, -A), (-A, -B).
+template <int A, int B>
+struct Leaper {
+  // Number of moves.
+  static const int N = 8;
+
+  // How far a move can reach along one axis.
+  static const int REACH = A > B ? A : B;
+
+  static constexpr int dx(int i) {
+    return i < 4 ? (i == 1 || i == 2 ? B : A) : -(i == 5 || i == 6 ? B : A);
+  }
+
+  static constexpr int dy(int i) {
+    return (i & 3) == 0 ? B : (i & 3) == 1 ? A : (i & 3) == 2 ? -A : -B;
+  }
+
+  static inline Vec2 move(int i) { return Vec2(dx(i), dy(i)); }
+
+  // Return the index of move, -1 if move is not valid for the piece.
+  static inline int moveIndex(const Vec2& move) {
+    if (move.x_ < -REACH || move.x_ > REACH || move.y_ < -REACH || move.y_ > REACH) return -1;
+    return table_.index_[(move.y_ + REACH) * SPAN + move.x_ + REACH];
+  }
+
+  static inline bool isValidMove(const Vec2& move) { return moveIndex(move) >= 0; }
+
+ private:
+  static const int SPAN = 2 * REACH + 1;
+
+  // Maps every displacement within reach to its move index.
+  struct IndexTable {
+    int index_[SPAN * SPAN];
+    IndexTable() {
+      std::fill(index_, index_ + SPAN * SPAN, -1);
+      for (int i = 0; i < N; ++i) index_[(dy(i) + REACH) * SPAN + dx(i) + REACH] = i;
+    }
+  };
+  static const IndexTable table_;
+};
+
+template <int A, int B>
+const typename Leaper<A, B>::IndexTable Leaper<A, B>::table_;
+
+typedef Leaper<1, 2> Knight;
+typedef Leaper<1, 3> Camel;
+typedef Leaper<2, 3> Zebra;
+
+// Cell layouts: how the cells of a depth x width grid are stored in a
+// flat array. x, y and dx, dy are grid coordinates, the grid includes
+// the padding of BasicBoard.
+
+// Rows one after the other. A move is a constant offset.
+class RowMajorLayout {
+ public:
+  RowMajorLayout(int depth, int width): width_(width), size_(depth * width) {}
+
+  inline int size() const { return size_; }
+
+  inline int index(int x, int y) const { return y * width_ + x; }
+
+  inline Vec2 pos(int i) const { return Vec2(i % width_, i / width_); }
+
+  // Return the index of the cell dx, dy away from cell i.
+  inline int shift(int i, int dx, int dy) const { return i + dy * width_ + dx; }
+
+ private:
+  int width_, size_;
+};
+
+// Square tiles of TILE x TILE cells in row major order, the cells of a
+// tile in row major order too. Most knight moves stay in their tile,
+// so on a wide board a search touches a few tiles instead of rows far
+// apart in memory. The last row and column of tiles may stick out of
+// the grid, their extra cells are never inside the board.
+class TiledLayout {
+ public:
+  static const int SHIFT = 4, TILE = 1 << SHIFT, MASK = TILE - 1, AREA = TILE * TILE;
+
+  TiledLayout(int depth, int width):
+      tilesPerRow_((width + MASK) >> SHIFT),
+      size_(((depth + MASK) >> SHIFT) * tilesPerRow_ * AREA) {}
+
+  inline int size() const { return size_; }
+
+  inline int index(int x, int y) const {
+    return ((y >> SHIFT) * tilesPerRow_ + (x >> SHIFT)) * AREA + ((y & MASK) << SHIFT) + (x & MASK);
+  }
+
+  inline Vec2 pos(int i) const {
+    const int tile = i / AREA;
+    return Vec2((tile % tilesPerRow_) * TILE + (i & MASK), (tile / tilesPerRow_) * TILE + ((i >> SHIFT) & MASK));
+  }
+
+  // Return the index of the cell dx, dy away from cell i. The shifts
+  // of negative tile coordinates round down, as g++ and clang do.
+  inline int shift(int i, int dx, int dy) const {
+    const int x = (i & MASK) + dx, y = ((i >> SHIFT) & MASK) + dy;
+    return (i & ~(AREA - 1)) + ((y >> SHIFT) * tilesPerRow_ + (x >> SHIFT)) * AREA +
+           ((y & MASK) << SHIFT) + (x & MASK);
+  }
+
+ private:
+  int tilesPerRow_, size_;
+};
+
+// The layout of the boards, row major unless built with -DKNIGHT_TILED.
+#ifdef KNIGHT_TILED
+typedef TiledLayout CellLayout;
+#else
+typedef RowMajorLayout CellLayout;
+#endif
+
+// Geometry of a depth x width board. Cells are stored flat in the
+// CellLayout order, surrounded by Piece::REACH rows and columns of
+// padding, so every move from an inside cell lands on a valid index.
+// Searches mark the padding cells as blocked in their state arrays (see
+// makeCells) and never need an isInside check in their neighbor loops.
+// Only posToIndex, indexToPos and shift know the layout.
+template <typename Piece>
+class BasicBoard {
+ public:
+  // Coordinate system:
+  // ---> x(width)
+  // |
+  // V
+  // y(depth)
+  BasicBoard(int depth, int width):
+      depth_(checkedDepth(depth, width)), width_(width), layout_(depth + 2 * PAD, width + 2 * PAD) {}
+
+  // An empty board, to be assigned later.
+  BasicBoard(): depth_(0), width_(0), layout_(2 * PAD, 2 * PAD) {}
+
+  inline int getDepth() const { return depth_; }
+
+  inline int getWidth() const { return width_; }
+
+  // Number of flat cells, padding included.
+  inline int size() const { return layout_.size(); }
+
+  inline bool isInside(const Vec2& pos) const {
+    return pos.x_ >= 0 && pos.x_ < width_ && pos.y_ >= 0 && pos.y_ < depth_;
+  }
+
+  // Return true if flat cell i is a padding cell.
+  inline bool isPadding(int i) const {
+    return !isInside(indexToPos(i));
+  }
+
+  // map 2d coordinate on the board to the flat cell index.
+  inline int posToIndex(const Vec2& u) const { return layout_.index(u.x_ + PAD, u.y_ + PAD); }
+
+  // map the flat cell index to the 2d coordinate on the board
+  inline Vec2 indexToPos(int i) const { return layout_.pos(i) - Vec2(PAD, PAD); }
+
+  // Return the flat index of the cell dx, dy away from cell u, which
+  // must be inside the padded board.
+  inline int shift(int u, int dx, int dy) const { return layout_.shift(u, dx, dy); }
+
+  // Return the flat index of u + Piece::move(i).
+  inline int neighbor(int u, int i) const { return layout_.shift(u, Piece::dx(i), Piece::dy(i)); }
+
+  // Calls f(v, i) for each v = u + Piece::move(i), padding included,
+  // until f returns true. Return true if f did.
+  template <typename F>
+  inline bool anyNeighbor(int u, F f) const {
+    NeighborStep<F> step = { u, layout_, f };
+    return Unroll<0, Piece::N>::any(step);
+  }
+
+  // Calls f(v, i) for each v = u + Piece::move(i), padding included.
+  template <typename F>
+  inline void forEachNeighbor(int u, F f) const {
+    anyNeighbor(u, [&f](int v, int i) { f(v, i); return false; });
+  }
+
+  // Return a state array with value inside for the board cells and
+  // value padding for the padding cells.
+  template <typename T>
+  std::vector<T> makeCells(const T& inside, const T& padding) const {
+    std::vector<T> cells(size(), padding);
+    for (int y = 0; y < depth_; ++y) {
+      for (int x = 0; x < width_; ++x) cells[posToIndex(Vec2(x, y))] = inside;
+    }
+    return cells;
+  }
+
+  static const int PAD = Piece::REACH;
+
+ private:
+  int depth_, width_;
+  CellLayout layout_;
+
+  // Return depth, or throw if the board is empty or its flat cells,
+  // padding included and rounded up to whole tiles for any layout, do
+  // not fit in an int.
+  static int checkedDepth(int depth, int width) {
+    if (depth <= 0) throw std::runtime_error("Board.depth_ must > 0");
+    if (width <= 0) throw std::runtime_error("Board.width_ must > 0");
+    const int64_t tile = TiledLayout::TILE;
+    const int64_t rows = (depth + int64_t(2 * PAD) + tile - 1) / tile * tile;
+    const int64_t columns = (width + int64_t(2 * PAD) + tile - 1) / tile * tile;
+    if (rows * columns > INT_MAX) throw std::runtime_error("Board too large.");
+    return depth;
+  }
+
+  template <typename F>
+  struct NeighborStep {
+    int u_;
+    const CellLayout& layout_;
+    F& f_;
+    inline bool operator()(int i) {
+      return f_(layout_.shift(u_, Piece::dx(i), Piece::dy(i)), i);
+    }
+  };
+
+}; // class BasicBoard
+
+typedef BasicBoard<Knight> Board;
+
+// A set of board cells, e.g. the visited cells of a search, that is
+// cleared in O(1): a cell is in the set if its stamp is at least the
+// current generation, and reset starts a new generation. Padding cells
+// can be put in the set for good, so searches never leave the board.
+template <typename Piece>
+class BasicStampedSet {
+ public:
+  BasicStampedSet(const BasicBoard<Piece>& board, bool withPadding):
+      stamps_(board.template makeCells<unsigned>(0, withPadding ? PERMANENT : 0)),
+      generation_(1) {}
+
+  // Remove every cell but the padding.
+  inline void reset() {
+    if (++generation_ == PERMANENT) {
+      // Stamps of older generations would look current again.
+      for (auto& stamp: stamps_) if (stamp != PERMANENT) stamp = 0;
+      generation_ = 1;
+    }
+  }
+
+  inline bool contains(int u) const { return stamps_[u] >= generation_; }
+
+  inline void insert(int u) { stamps_[u] = generation_; }
+
+ private:
+  static const unsigned PERMANENT = ~0u;
+  std::vector<unsigned> stamps_;
+  unsigned generation_;
+
+}; // class BasicStampedSet
+
+typedef BasicStampedSet<Knight> StampedSet;
+
+// Connected components of the knight moves on a board with no
+// obstacle, so a query between cells of different components is
+// answered without a search. The knight graph of a board of at least
+// 3 x 4 cells is connected and needs no labels. Smaller boards (a 3 x 3
+// board's center, any cell of a 1 or 2 cell wide board) get one label
+// per cell, found by a flood fill.
+class BoardComponents {
+ public:
+  explicit BoardComponents(const Board& board) {
+    const int depth = board.getDepth(), width = board.getWidth();
+    if (std::min(depth, width) >= 3 && std::max(depth, width) >= 4) return;
+
+    labels_ = board.makeCells(-1, -2);
+    std::vector<int> q;
+    for (int y = 0, label = 0; y < depth; ++y) {
+      for (int x = 0; x < width; ++x) {
+        const int s = board.posToIndex(Vec2(x, y));
+        if (labels_[s] != -1) continue;
+        labels_[s] = label;
+        q.assign(1, s);
+        for (size_t head = 0; head < q.size(); ++head) {
+          board.forEachNeighbor(q[head], [&](int v, int) {
+            if (labels_[v] != -1) return;
+            labels_[v] = label;
+            q.push_back(v);
+          });
+        }
+        ++label;
+      }
+    }
+  }
+
+  // Return true if the knight can go from cell u to cell v.
+  inline bool isConnected(int u, int v) const { return labels_.empty() || labels_[u] == labels_[v]; }
+
+ private:
+  // Empty if the board is connected, -2 for the padding cells.
+  std::vector<int> labels_;
+
+}; // class BoardComponents
+
+// One of the symmetries of the board (the dihedral group D4). A
+// symmetry first optionally transposes the board (swaps x and y), then
+// optionally mirrors x and/or y. A square board has 8 symmetries, a
+// non-square one only keeps the 4 that do not transpose.
+class Symmetry {
+ public:
+  enum { FLIP_X = 1, FLIP_Y = 2, TRANSPOSE = 4, COUNT = 8 };
+
+  Symmetry(int code, int depth, int width): code_(code), depth_(depth), width_(width) {
+    for (int i = 0; i < Knight::N; ++i) {
+      movePermutation_[i] = Knight::moveIndex(applyToMove(Knight::move(i)));
+    }
+  }
+
+  // Return all symmetries of a depth x width board, identity first.
+  static std::vector<Symmetry> all(int depth, int width) {
+    std::vector<Symmetry> symmetries;
+    for (int code = 0; code < COUNT; ++code) {
+      if ((code & TRANSPOSE) && depth != width) continue;
+      symmetries.push_back(Symmetry(code, depth, width));
+    }
+    return symmetries;
+  }
+
+  inline bool isIdentity() const { return code_ == 0; }
+
+  // Map position pos to its image.
+  inline Vec2 apply(const Vec2& pos) const {
+    Vec2 image = (code_ & TRANSPOSE) ? Vec2(pos.y_, pos.x_) : pos;
+    if (code_ & FLIP_X) image.x_ = width_ - 1 - image.x_;
+    if (code_ & FLIP_Y) image.y_ = depth_ - 1 - image.y_;
+    return image;
+  }
+
+  // Map a move to its image. Unlike positions, moves are not affected
+  // by the board size.
+  inline Vec2 applyToMove(const Vec2& move) const {
+    Vec2 image = (code_ & TRANSPOSE) ? Vec2(move.y_, move.x_) : move;
+    if (code_ & FLIP_X) image.x_ = -image.x_;
+    if (code_ & FLIP_Y) image.y_ = -image.y_;
+    return image;
+  }
+
+  // Return the index of the image of Knight::move(i).
+  inline int applyToMoveIndex(int i) const { return movePermutation_[i]; }
+
+  // Mirroring x before a transpose is the same as mirroring y after
+  // it, so the inverse of a transposing symmetry swaps the two flips.
+  Symmetry inverse() const {
+    if (!(code_ & TRANSPOSE)) return *this;
+    const int code = TRANSPOSE | ((code_ & FLIP_X) ? FLIP_Y : 0) | ((code_ & FLIP_Y) ? FLIP_X : 0);
+    return Symmetry(code, depth_, width_);
+  }
+
+ private:
+  int code_;
+  int depth_, width_;
+  int movePermutation_[Knight::N];
+
+}; // class Symmetry
+
+#endif // KNIGHT_H
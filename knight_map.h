@@ -0,0 +1,467 @@
+// The terrain map of level 4 and the knight graph it defines.
+#ifndef KNIGHT_MAP_H
+#define KNIGHT_MAP_H
+
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "knight.h"
+#include "stats.h"
+
+// A class for graph queries. Cells are stored flat with the padding
+// of Board, padding cells are ROCK so no move can leave the map.
+class KnightMap {
+ public:
+  enum CellType { DEFAULT = 0, WATER, ROCK, BARRIER, TELEPORT, LAVA };
+
+  KnightMap(int depth, int width): board_(depth, width) {
+    reset();
+  }
+
+  // An empty map, to be read with operator>>.
+  KnightMap() {}
+
+  // Read from istream
+  friend std::istream& operator>>(std::istream& from, KnightMap& map) {
+    std::ostringstream oss;
+    std::string line;
+    std::vector<CellType> cells;
+    int width = -1, depth = 0;
+    while (std::getline(from, line)) {
+      std::stringstream iss(line);
+      char c;
+      int widthThisRow = 0;
+      while (iss >> c) {
+        cells.push_back(parseCell(c));
+        ++widthThisRow;
+      }
+
+      // First row, do not check width, set it.
+      if (width <= 0) width = widthThisRow;
+
+      if (widthThisRow != width) {
+        oss.str("");
+        oss << "At row " << depth << ", width is " << widthThisRow << ", ";
+        oss << "but previous row width is " << width << ".";
+        throw std::runtime_error(oss.str());
+      }
+
+      ++depth;
+    }
+
+    map = KnightMap(depth, width);
+    for (int y = 0; y < depth; ++y) {
+      for (int x = 0; x < width; ++x) {
+        map.setCellType(Vec2(x, y), cells[y * width + x]);
+      }
+    }
+    map.indexComponents();
+    return from;
+  }
+
+  friend std::ostream& operator<<(std::ostream& to, const KnightMap& map) {
+    for (int y = 0, depth = map.getDepth(); y < depth; ++y) {
+      for (int x = 0, width = map.getWidth(); x < width; ++x) {
+        const Vec2 u(x, y);
+        const CellType type(map.getCellType(u));
+        switch (type) {
+          case DEFAULT: to << ". "; break;
+          case WATER: to << "W "; break;
+          case ROCK: to << "R "; break;
+          case BARRIER: to << "B "; break;
+          case TELEPORT: to << "T "; break;
+          case LAVA: to << "L "; break;
+        }
+      }
+      to << "\n";
+    }
+    return to;
+  }
+
+  inline void reset() {
+    cells_ = board_.makeCells(DEFAULT, ROCK);
+    teleports_.clear();
+    labels_.clear();
+    sizes_.clear();
+    freeLabels_.clear();
+  }
+
+  inline const Board& getBoard() const { return board_; }
+
+  inline int getDepth() const { return board_.getDepth(); }
+
+  inline int getWidth() const { return board_.getWidth(); }
+
+  // Return true if the pos is inside the map
+  inline bool isInside(const Vec2& pos) const { return board_.isInside(pos); }
+
+  // map 2d coordinate on the map to the flat cell index.
+  inline int posToIndex(const Vec2& u) const { return board_.posToIndex(u); }
+
+  // map the flat cell index to the 2d coordinate on the map
+  inline Vec2 indexToPos(int i) const { return board_.indexToPos(i); }
+
+  inline CellType getCellType(const Vec2& u) const {
+    return cells_[posToIndex(u)];
+  }
+
+  inline CellType getCellType(int u) const { return cells_[u]; }
+
+  inline void setCellType(const Vec2& u, const CellType& type) {
+    const int index = posToIndex(u);
+    const CellType old = cells_[index];
+    cells_[index] = type;
+    if (type == TELEPORT) {
+      teleports_.insert(index);
+    } else {
+      teleports_.erase(index);
+    }
+    if (!labels_.empty() && type != old) updateComponents(index, old);
+  }
+
+  // Label the connected components of the map, ignoring the direction
+  // of the moves, teleports all in one component. Done by operator>>,
+  // then kept up to date by setCellType.
+  void indexComponents() {
+    labels_ = board_.makeCells<int>(NO_LABEL, NO_LABEL);
+    sizes_.clear();
+    freeLabels_.clear();
+    for (int y = 0; y < getDepth(); ++y) {
+      for (int x = 0; x < getWidth(); ++x) {
+        const int u = posToIndex(Vec2(x, y));
+        if (isOpen(u) && labels_[u] == NO_LABEL) relabel(u, NO_LABEL, newLabel());
+      }
+    }
+  }
+
+  // Return true if the components of other, a map of the same board,
+  // are the same as these, whatever their labels: the labels of the
+  // cells map one to one. Costs O(cells).
+  bool hasSameComponents(const KnightMap& other) const {
+    if (labels_.size() != other.labels_.size()) return false;
+    std::vector<int> to(sizes_.size(), NO_LABEL), from(other.sizes_.size(), NO_LABEL);
+    for (size_t u = 0; u < labels_.size(); ++u) {
+      const int a = labels_[u], b = other.labels_[u];
+      if (a == NO_LABEL || b == NO_LABEL) {
+        if (a != b) return false;
+        continue;
+      }
+      if (to[a] == NO_LABEL) to[a] = b;
+      if (from[b] == NO_LABEL) from[b] = a;
+      if (to[a] != b || from[b] != a) return false;
+    }
+    return true;
+  }
+
+  // Number of component labels, in use or free: the components
+  // indexed so far at most, since setCellType reuses the labels of the
+  // components it empties.
+  inline int getLabelCount() const { return sizes_.size(); }
+
+  // Return false if there is no path from vertex u to vertex v. Costs
+  // O(1) (a few moves if u is a ROCK or BARRIER cell, which a query may
+  // start from), always true if the components are not indexed.
+  inline bool mayReach(int u, int v) const {
+    if (u == v || labels_.empty()) return true;
+    if (labels_[v] == NO_LABEL) return false;
+    if (labels_[u] != NO_LABEL) return labels_[u] == labels_[v];
+    bool reached = false;
+    adj(u, [&](int w) { reached = reached || labels_[w] == labels_[v]; });
+    return reached;
+  }
+
+  // The teleports, as flat indices.
+  inline const std::set<int>& getTeleports() const { return teleports_; }
+
+  // Calls f(v) for each vertex v that can be reached from vertex u.
+  template <typename F>
+  inline void adj(int u, F f) const {
+    // Regular valid chess knight moves. Padding cells are ROCK, so
+    // there is no need to check whether v is inside the map.
+    board_.forEachNeighbor(u, [&](int v, int i) {
+      const CellType type = cells_[v];
+
+      // Can not land on ROCK
+      if (type == ROCK) return;
+
+      // Can not cross or land on BARRIER
+      if (type == BARRIER || isCrossingBarrier(u, i)) return;
+
+      f(v);
+    });
+
+    // teleports
+    if (cells_[u] == TELEPORT) {
+      STATS_ADD(TELEPORT_EDGES, teleports_.size() - 1);
+      for (auto i : teleports_) {
+        if (u != i) f(i);
+      }
+    }
+  }
+
+  // Calls f(u) for each vertex u such that adj(u) contains vertex v,
+  // i.e. walks the edges backwards. u may be a padding cell, which no
+  // search reaches, and must not be expanded in turn.
+  template <typename F>
+  inline void radj(int v, F f) const {
+    // Same rules as adj: nothing lands on ROCK or BARRIER.
+    const CellType type = cells_[v];
+    if (type == ROCK || type == BARRIER) return;
+
+    for (int i = 0; i < Knight::N; ++i) {
+      const int u = board_.shift(v, -Knight::dx(i), -Knight::dy(i));
+      if (!isCrossingBarrier(u, i)) f(u);
+    }
+
+    // teleports
+    if (type == TELEPORT) {
+      for (auto i : teleports_) {
+        if (v != i) f(i);
+      }
+    }
+  }
+
+  // Return the vertex reached by applying move at vertex u, or -1 if
+  // adj(u) does not contain it. Costs O(1), so a path can be checked
+  // without any search.
+  inline int moveTarget(int u, const Vec2& move) const {
+    // Regular valid chess knight moves, same rules as adj.
+    const int i = Knight::moveIndex(move);
+    if (i >= 0) {
+      const int v = board_.neighbor(u, i);
+      const CellType type = cells_[v];
+      if (type != ROCK && type != BARRIER && !isCrossingBarrier(u, i)) return v;
+    }
+
+    // teleports
+    const Vec2 pos = indexToPos(u) + move;
+    if (cells_[u] == TELEPORT && isInside(pos)) {
+      const int v = posToIndex(pos);
+      if (v != u && cells_[v] == TELEPORT) return v;
+    }
+    return -1;
+  }
+
+  // Return the symmetries of the board that leave every cell type
+  // unchanged, identity first. Since adj and edgeWeight only look at
+  // cell types, each of them maps shortest paths to shortest paths.
+  std::vector<Symmetry> symmetries() const {
+    std::vector<Symmetry> result;
+    for (auto s: Symmetry::all(getDepth(), getWidth())) {
+      bool invariant = true;
+      for (int y = 0; y < getDepth() && invariant; ++y) {
+        for (int x = 0; x < getWidth() && invariant; ++x) {
+          const Vec2 u(x, y);
+          invariant = getCellType(s.apply(u)) == getCellType(u);
+        }
+      }
+      if (invariant) result.push_back(s);
+    }
+    return result;
+  }
+
+  // Return the weight for edge (u, v), the weight of the cell landed on.
+  inline int edgeWeight(int /*u*/, int v) const { return cellWeight(cells_[v]); }
+
+  // Return the weight of the edges landing on a cell of type type.
+  static inline int cellWeight(CellType type) {
+    const int NA = 1000;
+    switch (type) {
+      case WATER: return 2;
+      case ROCK: return NA;
+      case BARRIER: return NA;
+      case TELEPORT: return 0;
+      case LAVA: return 5;
+      default:
+        break;
+    }
+    return 1;
+  }
+
+  // The largest weight of an edge adj can report.
+  static const int MAX_EDGE_WEIGHT = 5;
+
+  // Return the type of the cell written c in the map format.
+  static CellType parseCell(char c) {
+    switch (c) {
+      case '.': return DEFAULT;
+      case 'W': return WATER;
+      case 'R': return ROCK;
+      case 'B': return BARRIER;
+      case 'T': return TELEPORT;
+      case 'L': return LAVA;
+      default:
+        break;
+    }
+    std::ostringstream oss;
+    oss << "Unknown cell " << c << ".";
+    throw std::runtime_error(oss.str());
+  }
+
+ protected:
+  Board board_;
+  std::vector<CellType> cells_;
+  std::set<int> teleports_;
+
+  // The component of each vertex, NO_LABEL for the ROCK, BARRIER and
+  // padding cells, and the number of vertices of each component.
+  // Empty if not indexed. The labels of empty components are free, and
+  // given to the next new components.
+  enum { NO_LABEL = -1 };
+  std::vector<int> labels_;
+  std::vector<int> sizes_;
+  std::vector<int> freeLabels_;
+
+  // Return the label of a new, empty component.
+  int newLabel() {
+    if (freeLabels_.empty()) {
+      sizes_.push_back(0);
+      return sizes_.size() - 1;
+    }
+    const int label = freeLabels_.back();
+    freeLabels_.pop_back();
+    return label;
+  }
+
+  // Free label if its component is empty.
+  inline void releaseLabel(int label) {
+    if (sizes_[label] == 0) freeLabels_.push_back(label);
+  }
+
+  // Return true if moves can land on vertex u.
+  inline bool isOpen(int u) const { return cells_[u] != ROCK && cells_[u] != BARRIER; }
+
+  // Label to the vertices connected to s and labeled from, s included,
+  // by a flood fill through the moves in both directions. Return their
+  // number.
+  int relabel(int s, int from, int to) {
+    std::vector<int> q(1, s);
+    labels_[s] = to;
+    bool teleported = false;
+    auto visit = [&](int v) {
+      if (labels_[v] != from) return;
+      labels_[v] = to;
+      q.push_back(v);
+    };
+    for (size_t head = 0; head < q.size(); ++head) {
+      const int u = q[head];
+      for (int i = 0; i < Knight::N; ++i) {
+        const int v = board_.neighbor(u, i);
+        if (isOpen(v) && !isCrossingBarrier(u, i)) visit(v);
+        const int w = board_.shift(u, -Knight::dx(i), -Knight::dy(i));
+        if (isOpen(w) && !isCrossingBarrier(w, i)) visit(w);
+      }
+      if (cells_[u] == TELEPORT && !teleported) {
+        teleported = true;
+        for (auto t : teleports_) visit(t);
+      }
+    }
+    sizes_[to] += q.size();
+    if (from != NO_LABEL) sizes_[from] -= q.size();
+    return q.size();
+  }
+
+  // Merge the components of vertices u and v, relabeling the smaller.
+  void join(int u, int v) {
+    int from = labels_[u], to = labels_[v];
+    if (from == to) return;
+    if (sizes_[from] > sizes_[to]) {
+      std::swap(from, to);
+      std::swap(u, v);
+    }
+    relabel(u, from, to);
+    releaseLabel(from);
+  }
+
+  // Update the components after vertex v changed from type old. A move
+  // is an edge unless it lands on a ROCK or BARRIER cell or crosses a
+  // BARRIER cell, and teleports are joined, so an edit that keeps every
+  // property of old, open, not BARRIER and TELEPORT, only adds edges:
+  // the components they join are merged. Otherwise it only removes
+  // edges, all of them with an end within two cells of v or at a
+  // teleport, and the components of these ends are labeled again from
+  // them, each piece a component split off gets a new label. The labels
+  // of the components left empty are freed.
+  void updateComponents(int v, CellType old) {
+    const CellType type = cells_[v];
+    const bool wasOpen = old != ROCK && old != BARRIER;
+    const bool addsOnly = (!wasOpen || isOpen(v)) && (old == BARRIER || type != BARRIER) &&
+                          (old != TELEPORT || type == TELEPORT);
+    if (addsOnly) {
+      if (isOpen(v) && !wasOpen) {
+        labels_[v] = newLabel();
+        sizes_[labels_[v]] = 1;
+      }
+      for (int i = 0; i < Knight::N; ++i) {
+        // Moves from and to v.
+        if (isOpen(v)) {
+          const int w = board_.neighbor(v, i);
+          if (isOpen(w) && !isCrossingBarrier(v, i)) join(w, v);
+          const int u = board_.shift(v, -Knight::dx(i), -Knight::dy(i));
+          if (isOpen(u) && !isCrossingBarrier(u, i)) join(u, v);
+        }
+        // Moves crossing v.
+        const int u = board_.shift(v, -(Knight::dx(i) / 2), -(Knight::dy(i) / 2));
+        const int w = board_.neighbor(u, i);
+        if (isOpen(u) && isOpen(w) && !isCrossingBarrier(u, i)) join(u, w);
+      }
+      if (type == TELEPORT) {
+        for (auto t : teleports_) {
+          if (t != v) {
+            join(t, v);
+            break;
+          }
+        }
+      }
+      return;
+    }
+
+    if (!isOpen(v) && labels_[v] != NO_LABEL) {
+      const int label = labels_[v];
+      --sizes_[label];
+      labels_[v] = NO_LABEL;
+      releaseLabel(label);
+    }
+    std::vector<int> ends;
+    for (int dy = -2; dy <= 2; ++dy) {
+      for (int dx = -2; dx <= 2; ++dx) ends.push_back(board_.shift(v, dx, dy));
+    }
+    if (old == TELEPORT) ends.insert(ends.end(), teleports_.begin(), teleports_.end());
+
+    // A new label is never the label of a vertex, so an end whose label
+    // changed is in a piece labeled already. The old labels are freed
+    // once every piece is labeled, not to be given to a piece meanwhile.
+    std::vector<int> oldLabels;
+    for (auto u : ends) oldLabels.push_back(labels_[u]);
+    for (size_t i = 0; i < ends.size(); ++i) {
+      if (oldLabels[i] == NO_LABEL || labels_[ends[i]] != oldLabels[i]) continue;
+      relabel(ends[i], oldLabels[i], newLabel());
+    }
+    std::sort(oldLabels.begin(), oldLabels.end());
+    oldLabels.erase(std::unique(oldLabels.begin(), oldLabels.end()), oldLabels.end());
+    for (auto label : oldLabels) {
+      if (label != NO_LABEL) releaseLabel(label);
+    }
+  }
+
+  // Return true if the move Knight::move(i) from u crossed a barrier.
+  // Prerequisite: v = u + move is still inside map.
+
+  // The following are the invalid cases for move = (2, 1)
+  // 1)  u B .    2)  u . .   3)  u B .
+  //     . . x        . B x       . B x
+  inline bool isCrossingBarrier(int u, int i) const {
+    // The cell next to u along the long leg of the move. Halving the
+    // short leg truncates it to 0.
+    const int mid1 = board_.shift(u, Knight::dx(i) / 2, Knight::dy(i) / 2);
+    return cells_[mid1] == BARRIER;
+  }
+
+}; // class KnightMap
+
+#endif // KNIGHT_MAP_H
@@ -1,6 +1,22 @@
 #include <vector>
+#include <string>
 #include <sstream>
+#include <fstream>
 #include <iostream>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "knight.h"
+#include "knight_map.h"
 
 struct Config {
   int depth_, width_;
@@ -11,74 +27,6 @@ struct Config {
   {}
 };
 
-// Simple vector class representing position on the board as well as
-// movement.
-struct Vec2 {
-  int x_, y_;
-  Vec2(int x, int y): x_(x), y_(y) {}
-  Vec2& operator+=(const Vec2& other) {
-    x_ += other.x_;
-    y_ += other.y_;
-    return *this;
-  }
-};
-
-// Comparator, used in std::find
-bool operator==(const Vec2& v1, const Vec2& v2) {
-  return v1.x_ == v2.x_ && v1.y_ == v2.y_;
-}
-
-// A class encapsulate the rule the a knight must follow. At any
-// point, a knight might have 8 potential moves.
-class ChessRule {
- public:
-  // Since the set of valid moves is very small (only 8 elements), use
-  // std::vector is efficient even for linear search.
-  static const std::vector<Vec2> validKnightMoves;
-
-  static bool isValidKnightMove(const Vec2& move) {
-    return std::find(validKnightMoves.begin(), validKnightMoves.end(), move) !=
-        validKnightMoves.end();
-  }
-}; // class ChessRule
-
-const std::vector<Vec2> ChessRule::validKnightMoves = {
-  { +1, +2 },
-  { +2, +1 },
-  { +2, -1 },
-  { +1, -2 },
-  { -1, +2 },
-  { -2, +1 },
-  { -2, -1 },
-  { -1, -2 }
-};
-
-// An immutable class provides query functions: getWidth, getDepth and isInside.
-class Board {
- public:
-  // Coordinate system:
-  // ---> x(width)
-  // |
-  // V
-  // y(depth)
-  Board(int depth, int width): depth_(depth), width_(width) {
-    if (depth_ <= 0) throw std::runtime_error("Board.depth_ must > 0");
-    if (width_ <= 0) throw std::runtime_error("Board.width_ must > 0");
-  }
-
-  int getDepth() const { return depth_; }
-
-  int getWidth() const { return width_; }
-
-  bool isInside(const Vec2& pos) const {
-    return pos.x_ >= 0 && pos.x_ < width_ && pos.y_ >= 0 && pos.y_ < depth_;
-  }
-
- private:
-  int depth_, width_;
-
-}; // class Board
-
 // Some helper function to print the program states.
 void printInvalidInitialPos(const Board& board, const Vec2& pos, std::ostream& to) {
   to << "Initial position (" << pos.x_ << ", " << pos.y_ << ") is not inside the ";
@@ -93,16 +41,6 @@ void printConfig(const Config& config, std::ostream& to) {
   to << "verbose_: " << config.verbose_ << "\n";
 }
 
-void printKightBoard(const Board& board, const Vec2& knightPos, std::ostream& to) {
-  const int depth = board.getDepth(), width = board.getWidth();
-  for (int y = 0; y < depth; ++y) {
-    for (int x = 0; x < width; ++x) {
-      to << (knightPos.x_ == x && knightPos.y_ == y ? "K " : ". ");
-    }
-    to << "\n";
-  }
-}
-
 void printInvalidMove(const Vec2& move, std::ostream& to) {
   to << "Move (" << move.x_ << ", " << move.y_ << ") is not a valid knight move.\n";
 }
@@ -116,6 +54,83 @@ void printNewPosOutsideBoard(const Vec2& move, const Vec2& newPos, std::ostream&
   to << "new position (" << newPos.x_ << ", " << newPos.y_ << ") is outside the board.\n";
 }
 
+void printInvalidMapMove(const Vec2& pos, const Vec2& move, std::ostream& to) {
+  to << "Move (" << move.x_ << ", " << move.y_ << ") from (" << pos.x_ << ", " << pos.y_;
+  to << ") is not allowed on the map.\n";
+}
+
+// Renders the knight board in verbose mode. The board is drawn once
+// into a preallocated frame buffer, after that each state only
+// patches the cell the knight left and the one it entered. A frame is
+// written with a single writev(2), together with the text printed
+// since the previous frame. Only every stride-th state is written.
+class BoardRenderer {
+ public:
+  BoardRenderer(const Board& board, int stride, int fd):
+      board_(board), stride_(stride), fd_(fd), numStates_(0), knight_(-1) {}
+
+  ~BoardRenderer() { flush(); }
+
+  // Text to print before the next frame.
+  std::ostream& text() { return text_; }
+
+  // Move the knight to pos, which must be inside the board.
+  void render(const Vec2& pos) {
+    const int rowSize = 2 * board_.getWidth() + 1;
+    if (frame_.empty()) {
+      // Allocated on first use, so non verbose runs on large boards
+      // do not pay for it.
+      frame_.assign(board_.getDepth() * rowSize, ' ');
+      for (int y = 0; y < board_.getDepth(); ++y) {
+        for (int x = 0; x < board_.getWidth(); ++x) frame_[y * rowSize + 2 * x] = '.';
+        frame_[y * rowSize + rowSize - 1] = '\n';
+      }
+    }
+
+    if (knight_ >= 0) frame_[knight_] = '.';
+    knight_ = pos.y_ * rowSize + 2 * pos.x_;
+    frame_[knight_] = 'K';
+
+    if (numStates_++ % stride_ == 0) write(true);
+  }
+
+  // Write the pending text.
+  void flush() { write(false); }
+
+ private:
+  const Board& board_;
+  const int stride_;
+  const int fd_;
+  int numStates_;
+  int knight_;
+  std::vector<char> frame_;
+  std::ostringstream text_;
+
+  void write(bool withFrame) {
+    std::cout.flush();
+    const std::string text = text_.str();
+    text_.str("");
+
+    struct iovec iov[2] = {
+      { const_cast<char*>(text.data()), text.size() },
+      { frame_.data(), withFrame ? frame_.size() : 0 }
+    };
+    for (int i = 0; i < 2;) {
+      const ssize_t n = writev(fd_, iov + i, 2 - i);
+      if (n < 0) throw std::runtime_error("Can not write frame.");
+
+      // Skip what was written, writev may stop short.
+      size_t left = n;
+      for (; i < 2 && left >= iov[i].iov_len; ++i) left -= iov[i].iov_len;
+      if (i < 2) {
+        iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + left;
+        iov[i].iov_len -= left;
+      }
+    }
+  }
+
+}; // class BoardRenderer
+
 // Read config from istream.
 Config readConfig(std::istream& from) {
   Config config;
@@ -149,20 +164,24 @@ bool validateMoves(const std::vector<Vec2>& moves, const Config& config) {
   Vec2 knightPos(config.startX_, config.startY_);
   const bool verbose = config.verbose_;
 
-  if (verbose) printConfig(config, std::cout);
+  // In verbose mode, every verbose_-th state of the board is printed.
+  BoardRenderer renderer(board, std::max(config.verbose_, 1), STDOUT_FILENO);
+  std::ostream& to = renderer.text();
+
+  if (verbose) printConfig(config, to);
 
   // Check the initial position of the knight.
   if (!board.isInside(knightPos)) {
-    if (verbose) printInvalidInitialPos(board, knightPos, std::cout);
+    if (verbose) printInvalidInitialPos(board, knightPos, to);
     return false;
   }
 
-  if (verbose) printKightBoard(board, knightPos, std::cout);
+  if (verbose) renderer.render(knightPos);
 
   for (auto move : moves) {
     // Check where the move is a valid knight move based on chess rule
-    if (!ChessRule::isValidKnightMove(move)) {
-      if (verbose) printInvalidMove(move, std::cout);
+    if (!Knight::isValidMove(move)) {
+      if (verbose) printInvalidMove(move, to);
       return false;
     }
 
@@ -171,19 +190,220 @@ bool validateMoves(const std::vector<Vec2>& moves, const Config& config) {
 
     // Check whether knight is still inside the board.
     if (!board.isInside(knightPos)) {
-      if (verbose) printNewPosOutsideBoard(move, knightPos, std::cout);
+      if (verbose) printNewPosOutsideBoard(move, knightPos, to);
       return false;
     }
 
     if (verbose) {
-      printValidMove(move, std::cout);
-      printKightBoard(board, knightPos, std::cout);
+      printValidMove(move, to);
+      renderer.render(knightPos);
+    }
+  }
+  return true;
+}
+
+// Map mode: check the moves against the rules of level 4 (rocks,
+// barriers and teleports, see KnightMap::adj) and sum their edge
+// weights into cost. A single pass over the moves, no search.
+bool validatePath(const KnightMap& map, const Vec2& start, const std::vector<Vec2>& moves,
+                  bool verbose, int& cost) {
+  cost = 0;
+  if (!map.isInside(start)) {
+    if (verbose) printInvalidInitialPos(map.getBoard(), start, std::cout);
+    return false;
+  }
+
+  int u = map.posToIndex(start);
+  for (auto move : moves) {
+    const int v = map.moveTarget(u, move);
+    if (v < 0) {
+      if (verbose) printInvalidMapMove(map.indexToPos(u), move, std::cout);
+      return false;
     }
+
+    cost += map.edgeWeight(u, v);
+    u = v;
+    if (verbose) printValidMove(move, std::cout);
+  }
+  return true;
+}
+
+// Batch mode: validate many move sequences stored one record per line
+//   <depth> <width> <startX> <startY> <x1> <y1> <x2> <y2> ...
+// and print one verdict per record, in input order: "0" if the moves
+// are valid, "1 <k>" if the k-th move (counting from 0) is the first
+// invalid one, k is -1 if the record or its initial position is
+// invalid. Empty lines are skipped.
+
+// Parse a signed integer at p, skipping blanks but not newlines.
+// Return false if the line ends before a number. Throws if the line
+// holds something else, or a number out of the range of int.
+inline bool scanInt(const char*& p, const char* end, int& value) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+  if (p == end || *p == '\n') return false;
+
+  bool negative = false;
+  if (*p == '-' || *p == '+') negative = *p++ == '-';
+  if (p == end || *p < '0' || *p > '9') {
+    throw std::runtime_error("Batch record contains a non-integer.");
   }
+
+  int n = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    const int digit = *p++ - '0';
+    if (n > (INT_MAX - digit) / 10) throw std::runtime_error("Batch record contains a too large integer.");
+    n = n * 10 + digit;
+  }
+  value = negative ? -n : n;
   return true;
 }
 
+// Validate the record on the line starting at p, and advance p to the
+// next line. Return the index of the first invalid move, -1 if the
+// record is invalid as a whole, or the number of moves if all moves
+// are valid.
+int validateRecord(const char*& p, const char* end, bool& valid) {
+  int depth, width, x, y;
+  valid = false;
+  if (!scanInt(p, end, depth) || !scanInt(p, end, width) ||
+      !scanInt(p, end, x) || !scanInt(p, end, y) || depth <= 0 || width <= 0 ||
+      static_cast<unsigned>(x) >= static_cast<unsigned>(width) ||
+      static_cast<unsigned>(y) >= static_cast<unsigned>(depth)) {
+    while (p < end && *p++ != '\n') {}
+    return -1;
+  }
+
+  int k = 0;
+  Vec2 move;
+  valid = true;
+  while (valid && scanInt(p, end, move.x_)) {
+    // Check the move by table lookup, then only the coordinates it
+    // changed. A rejected move is not applied: its values may be any
+    // int.
+    valid = scanInt(p, end, move.y_) && Knight::isValidMove(move);
+    if (!valid) break;
+    x += move.x_;
+    y += move.y_;
+    valid = static_cast<unsigned>(x) < static_cast<unsigned>(width) &&
+        static_cast<unsigned>(y) < static_cast<unsigned>(depth);
+    if (valid) ++k;
+  }
+
+  while (p < end && *p++ != '\n') {}
+  return k;
+}
+
+// Validate the records in [begin, end), appending the verdicts to out.
+// Return the number of invalid records.
+int validateChunk(const char* begin, const char* end, std::string& out) {
+  int numInvalid = 0;
+  char verdict[32];
+  for (const char* p = begin; p < end;) {
+    if (*p == '\n') {
+      ++p;
+      continue;
+    }
+
+    // A malformed record is invalid as a whole, the next ones are
+    // still validated.
+    bool valid;
+    int k;
+    try {
+      k = validateRecord(p, end, valid);
+    } catch (const std::runtime_error&) {
+      while (p < end && *p++ != '\n') {}
+      valid = false;
+      k = -1;
+    }
+    if (valid) {
+      out += "0\n";
+    } else {
+      out.append(verdict, std::snprintf(verdict, sizeof(verdict), "1 %d\n", k));
+      ++numInvalid;
+    }
+  }
+  return numInvalid;
+}
+
+// Validate every record of the file at path, with numThreads workers
+// each taking the next chunk of whole lines and formatting verdicts
+// into its own buffer. Return true if all records are valid.
+bool validateBatch(const char* path, int numThreads, std::ostream& to) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) throw std::runtime_error(std::string("Can not open ") + path + ".");
+  struct stat st;
+  fstat(fd, &st);
+  const size_t size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    return true;
+  }
+
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) throw std::runtime_error(std::string("Can not mmap ") + path + ".");
+  madvise(addr, size, MADV_SEQUENTIAL);
+  const char* data = static_cast<const char*>(addr);
+
+  // Cut the file into chunks ending at line breaks.
+  const size_t chunkSize = 1 << 20;
+  std::vector<const char*> cuts(1, data);
+  while (cuts.back() < data + size) {
+    const char* cut = std::min(cuts.back() + chunkSize, data + size);
+    while (cut < data + size && cut[-1] != '\n') ++cut;
+    cuts.push_back(cut);
+  }
+
+  const int numChunks = cuts.size() - 1;
+  std::vector<std::string> verdicts(numChunks);
+  std::vector<int> numInvalid(numChunks);
+  std::atomic<int> next(0);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < std::max(1, std::min(numThreads, numChunks)); ++i) {
+    workers.push_back(std::thread([&]() {
+      for (int c = next++; c < numChunks; c = next++) {
+        numInvalid[c] = validateChunk(cuts[c], cuts[c + 1], verdicts[c]);
+      }
+    }));
+  }
+  for (auto& worker: workers) worker.join();
+  munmap(addr, size);
+
+  bool allValid = true;
+  for (int c = 0; c < numChunks; ++c) {
+    to.write(verdicts[c].data(), verdicts[c].size());
+    allValid = allValid && numInvalid[c] == 0;
+  }
+  return allValid;
+}
+
 int main(int argc, char* argv[]) {
+  // l1 --batch <file> [threads]
+  if (argc >= 3 && std::string(argv[1]) == "--batch") {
+    const int numThreads = argc >= 4 ? std::atoi(argv[3]) : std::thread::hardware_concurrency();
+    return validateBatch(argv[2], numThreads, std::cout) ? 0 : 1;
+  }
+
+  // l1 --map <file>, the map is in level 4 format.
+  if (argc >= 3 && std::string(argv[1]) == "--map") {
+    std::ifstream mapFile(argv[2]);
+    if (!mapFile) throw std::runtime_error(std::string("Can not open ") + argv[2] + ".");
+    KnightMap map;
+    mapFile >> map;
+
+    Vec2 start;
+    int verbose = 0, cost = 0;
+    std::string line;
+    std::getline(std::cin, line);
+    std::stringstream iss(line);
+    iss >> start.x_ >> start.y_ >> verbose;
+    std::vector<Vec2> moves = readMoves(std::cin);
+
+    if (!validatePath(map, start, moves, verbose, cost)) return 1;
+    std::cout << cost << "\n";
+    return 0;
+  }
+
   Config config = readConfig(std::cin);
   std::vector<Vec2> moves = readMoves(std::cin);
 
@@ -1,109 +1,50 @@
 #include <vector>
+#include <memory>
 #include <sstream>
 #include <iostream>
 #include <ios>
 
-// Simple vector class representing position on the board as well as
-// movement.
-struct Vec2 {
-  int x_, y_;
-  Vec2(int x, int y): x_(x), y_(y) {}
-  Vec2(): x_(0), y_(0) {}
+#include "knight.h"
+#include "server.h"
+#include "batch.h"
+#include "stats.h"
+#include "output.h"
+#include "control.h"
+
+// The state of depth first searches on one board, reused from one
+// search to the next. Visited cells are a StampedSet, so starting a
+// new search costs O(1) instead of O(cells). The components answer
+// the queries with no path without a search.
+struct SearchContext {
+  Board board_;
+  StampedSet visited_;
+  BoardComponents components_;
+
+  SearchContext(int depth, int width):
+      board_(depth, width), visited_(board_, true), components_(board_) {}
 };
 
-// Comparator, used in std::find
-bool operator==(const Vec2& v1, const Vec2& v2) {
-  return v1.x_ == v2.x_ && v1.y_ == v2.y_;
-}
-
-// Sum
-Vec2 operator+(const Vec2& v1, const Vec2& v2) {
-  return Vec2(v1.x_ + v2.x_, v1.y_ + v2.y_);
-}
-
-// Substract
-Vec2 operator-(const Vec2& v1, const Vec2& v2) {
-  return Vec2(v1.x_ - v2.x_, v1.y_ - v2.y_);
-}
-
-// A class encapsulate the rule the a knight must follow. At any
-// point, a knight might have 8 potential moves.
-class ChessRule {
- public:
-  // Since the set of valid moves is very small (only 8 elements), use
-  // std::vector is efficient even for linear search.
-  static const std::vector<Vec2> validKnightMoves;
-
-  static bool isValidKnightMove(const Vec2& move) {
-    return std::find(validKnightMoves.begin(), validKnightMoves.end(), move) !=
-        validKnightMoves.end();
-  }
-}; // class ChessRule
-
-const std::vector<Vec2> ChessRule::validKnightMoves = {
-  { +1, +2 },
-  { +2, +1 },
-  { +2, -1 },
-  { +1, -2 },
-  { -1, +2 },
-  { -2, +1 },
-  { -2, -1 },
-  { -1, -2 }
-};
-
-// A helper class to store the vertex states of depth first search.
-class Board {
- public:
-  // Coordinate system:
-  // ---> x(width)
-  // |
-  // V
-  // y(depth)
-  Board(int depth, int width): depth_(depth), width_(width) {
-    if (depth_ <= 0) throw std::runtime_error("Board.depth_ must > 0");
-    if (width_ <= 0) throw std::runtime_error("Board.width_ must > 0");
-    visited_.resize(depth_ * width_, false);
-  }
-
-  // Return whether the vertex is visited or not.
-  inline bool getVisited(const Vec2& pos) const {
-    return visited_[pos.y_ * width_ + pos.x_];
-  }
-
-  // Set whether the vertex is visited or not.
-  inline void setVisited(const Vec2& pos, bool visited) {
-    visited_[pos.y_ * width_ + pos.x_] = visited;
-  }
-
-  inline bool isInside(const Vec2& pos) const {
-    return pos.x_ >= 0 && pos.x_ < width_ && pos.y_ >= 0 && pos.y_ < depth_;
-  }
-
- private:
-  int depth_, width_;
-  std::vector<bool> visited_;
-
-}; // class Board
-
 // Depth first search for a path from u to dest. Return true if found
-// a path. board stores the visited state, movesSofar store the
-// sequence of moves from start to current vertex u.
-bool dfs(const Vec2& u, const Vec2& dest, Board& board, std::vector<Vec2>& movesSofar) {
+// a path. visited stores the visited state, padding cells included,
+// movesSofar store the sequence of moves from start to current vertex
+// u.
+bool dfs(int u, int dest, const Board& board, StampedSet& visited,
+         std::vector<Vec2>& movesSofar, SearchControl& control) {
   if (u == dest) return true;
 
-  board.setVisited(u, true);
+  control.tick();
+  STATS_COUNT(EXPANDED);
+  STATS_MAX(MAX_FRONTIER, movesSofar.size());
+  visited.insert(u);
   // foreach neighbor v of u, if it is not visited, recursive dfs.
-  for (auto move: ChessRule::validKnightMoves) {
-    Vec2 v = u + move;
-    if (!board.isInside(v)) continue;
-
-    if (!board.getVisited(v)) {
-      movesSofar.push_back(move);
-      if (dfs(v, dest, board, movesSofar)) return true;
-      movesSofar.pop_back();
-    }
-  }
-  return false;
+  return board.anyNeighbor(u, [&](int v, int i) {
+    STATS_COUNT(RELAXED);
+    if (visited.contains(v)) return false;
+    movesSofar.push_back(Knight::move(i));
+    if (dfs(v, dest, board, visited, movesSofar, control)) return true;
+    movesSofar.pop_back();
+    return false;
+  });
 }
 
 // Main logic of level-2
@@ -113,32 +54,158 @@ struct MoveResult {
   MoveResult(): found_(false), moves_(0) {}
 };
 
-MoveResult findMoves(int depth, int width, const Vec2& start, const Vec2& end) {
+// Find a path from start to end, appending its moves to moves.
+// Return false if there is none. Throws SearchCancelled if control is
+// cancelled or its deadline passes.
+bool findMoves(SearchContext& context, const Vec2& start, const Vec2& end,
+               std::vector<Vec2>& moves, SearchControl& control) {
+  const Board& board = context.board_;
+  if (!board.isInside(start) || !board.isInside(end)) return false;
+
+  const int s = board.posToIndex(start), t = board.posToIndex(end);
+  if (!context.components_.isConnected(s, t)) return false;
+
+  context.visited_.reset();
+  STATS_PHASE(SEARCH);
+  return dfs(s, t, board, context.visited_, moves, control);
+}
+
+MoveResult findMoves(SearchContext& context, const Vec2& start, const Vec2& end,
+                     SearchControl& control) {
   MoveResult result;
-  Board board(depth, width);
-  result.found_ = dfs(start, end, board, result.moves_);
+  result.found_ = findMoves(context, start, end, result.moves_, control);
   return result;
 }
 
+MoveResult findMoves(int depth, int width, const Vec2& start, const Vec2& end,
+                     SearchControl& control) {
+  std::unique_ptr<SearchContext> context;
+  {
+    STATS_PHASE(BUILD);
+    context.reset(new SearchContext(depth, width));
+  }
+  return findMoves(*context, start, end, control);
+}
+
+// Server mode, a request is <depth> <width> <startX> <startY> <endX>
+// <endY>, answered within timeout milliseconds (no limit if 0). Each
+// connection keeps its search context while the board size does not
+// change.
+Handler makeHandler(int timeout) {
+  std::shared_ptr<std::unique_ptr<SearchContext> > context(new std::unique_ptr<SearchContext>);
+  return [context, timeout](const std::vector<int>& request, std::vector<int>& response) {
+    if (request.size() != 6) {
+      response.push_back(BAD_REQUEST);
+      return;
+    }
+    const int depth = request[0], width = request[1];
+    std::unique_ptr<SearchContext>& c = *context;
+    if (!c || c->board_.getDepth() != depth || c->board_.getWidth() != width) {
+      c.reset(new SearchContext(depth, width));
+    }
+
+    SearchControl control;
+    control.setTimeout(timeout);
+    MoveResult result;
+    try {
+      result = findMoves(*c, Vec2(request[2], request[3]), Vec2(request[4], request[5]), control);
+    } catch (const SearchCancelled&) {
+      response.push_back(TIMEOUT);
+      return;
+    }
+    if (!result.found_) {
+      response.push_back(NO_PATH);
+    } else {
+      appendMoves(result.moves_.size(), result.moves_, response);
+    }
+  };
+}
+
+// Batch mode, a query is <depth> <width> <startX> <startY> <endX>
+// <endY>, answered within timeout milliseconds (no limit if 0). Each
+// thread keeps its search context while the board size does not
+// change, and its move vector.
+Worker makeWorker(int timeout) {
+  struct State {
+    std::unique_ptr<SearchContext> context_;
+    std::vector<Vec2> moves_;
+  };
+  std::shared_ptr<State> state(new State);
+  return [state, timeout](const std::vector<int>& query, std::string& out) {
+    if (query.size() != 6) {
+      out += "BAD_REQUEST\n";
+      return;
+    }
+    const int depth = query[0], width = query[1];
+    std::unique_ptr<SearchContext>& context = state->context_;
+    if (!context || context->board_.getDepth() != depth || context->board_.getWidth() != width) {
+      STATS_PHASE(BUILD);
+      context.reset(new SearchContext(depth, width));
+    }
+
+    state->moves_.clear();
+    SearchControl control;
+    control.setTimeout(timeout);
+    bool found;
+    try {
+      found = findMoves(*context, Vec2(query[2], query[3]), Vec2(query[4], query[5]), state->moves_,
+                        control);
+    } catch (const SearchCancelled&) {
+      out += "TIMEOUT\n";
+      return;
+    }
+    if (!found) {
+      out += "NULL\n";
+    } else {
+      appendMoveLines(state->moves_, out);
+    }
+  };
+}
+
 int main(int argc, char* argv[]) {
-  std::string line;
-  std::getline(std::cin, line);
-  std::stringstream iss(line);
+  // l2 [--deadline <ms>] ...
+  const int timeout = parseDeadline(argc, argv);
+
+  // l2 --batch [threads]
+  if (argc >= 2 && std::string(argv[1]) == "--batch") {
+    std::ios::sync_with_stdio(false);
+    const int numThreads = argc >= 3 ? std::atoi(argv[2]) : std::thread::hardware_concurrency();
+    runBatch(std::cin, std::cout, numThreads, [timeout]() { return makeWorker(timeout); });
+    return 0;
+  }
+
+  // l2 --serve <socket>
+  if (argc >= 3 && std::string(argv[1]) == "--serve") {
+    serve(argv[2], [timeout]() { return makeHandler(timeout); });
+    return 0;
+  }
+
+  // l2 [--binary]
+  const bool binary = argc >= 2 && std::string(argv[1]) == "--binary";
+
   int depth, width;
   Vec2 start, end;
-  bool verbose;
-  iss >> depth >> width;
-  iss >> start.x_ >> start.y_;
-  iss >> end.x_ >> end.y_;
-
-  MoveResult result = findMoves(depth, width, start, end);
-
-  if (!result.found_) {
-    std::cout << "NULL\n";
-  } else {
-    std::cout << std::showpos;
-    for (auto move : result.moves_) {
-      std::cout << move.x_ << "\t" << move.y_ << "\n";
-    }
+  {
+    STATS_PHASE(PARSE);
+    std::string line;
+    std::getline(std::cin, line);
+    std::stringstream iss(line);
+    iss >> depth >> width;
+    iss >> start.x_ >> start.y_;
+    iss >> end.x_ >> end.y_;
+  }
+
+  SearchControl control;
+  control.setTimeout(timeout);
+  MoveResult result;
+  try {
+    result = findMoves(depth, width, start, end, control);
+  } catch (const SearchCancelled&) {
+    std::cout << "TIMEOUT\n";
+    return 3;
   }
+
+  STATS_PHASE(PRINT);
+  FdWriter out(STDOUT_FILENO);
+  writeResult(result.found_, false, 0, result.moves_, binary, out);
 }
@@ -1,193 +1,345 @@
 #include <vector>
-#include <queue>
+#include <map>
+#include <tuple>
+#include <memory>
 #include <sstream>
 #include <iostream>
 #include <ios>
 
-// Simple vector class representing position on the board as well as
-// movement.
-struct Vec2 {
-  int x_, y_;
-  Vec2(int x, int y): x_(x), y_(y) {}
-  Vec2(): x_(0), y_(0) {}
-};
+#include "knight.h"
+#include "server.h"
+#include "batch.h"
+#include "stats.h"
+#include "output.h"
+#include "control.h"
+#include "reach.h"
+#include "path_dag.h"
 
-// Comparator, used in std::find
-bool operator==(const Vec2& v1, const Vec2& v2) {
-  return v1.x_ == v2.x_ && v1.y_ == v2.y_;
-}
+// The state of breadth first searches on one board, reused from one
+// search to the next. Visited cells are a StampedSet, so starting a
+// new search costs O(1) instead of O(cells). The components answer
+// the queries with no path without a search.
+struct SearchContext {
+  Board board_;
+  StampedSet visited_;
+  std::vector<int> prev_;
+  std::vector<int> queue_;
+  BoardComponents components_;
 
-// Sum
-Vec2 operator+(const Vec2& v1, const Vec2& v2) {
-  return Vec2(v1.x_ + v2.x_, v1.y_ + v2.y_);
-}
+  SearchContext(int depth, int width):
+      board_(depth, width), visited_(board_, true), prev_(board_.size(), -1), components_(board_) {
+    queue_.reserve(depth * width);
+  }
+};
 
-// Substract
-Vec2 operator-(const Vec2& v1, const Vec2& v2) {
-  return Vec2(v1.x_ - v2.x_, v1.y_ - v2.y_);
-}
+// Bread first search for a shortest path from start to dest, both
+// inside the board of context.
+bool bfs(const Vec2& start, const Vec2& dest, SearchContext& context, std::vector<Vec2>& moves,
+         SearchControl& control) {
+  const Board& board = context.board_;
+  StampedSet& visited = context.visited_;
+  std::vector<int>& prev = context.prev_;
+  std::vector<int>& q = context.queue_;
 
-// A class encapsulate the rule the a knight must follow. At any
-// point, a knight might have 8 potential moves.
-class ChessRule {
- public:
-  // Since the set of valid moves is very small (only 8 elements), use
-  // std::vector is efficient even for linear search.
-  static const std::vector<Vec2> validKnightMoves;
+  // Padding cells are always visited, so the search never leaves the
+  // board.
+  visited.reset();
+  q.clear();
 
-  static bool isValidKnightMove(const Vec2& move) {
-    return std::find(validKnightMoves.begin(), validKnightMoves.end(), move) !=
-        validKnightMoves.end();
-  }
-}; // class ChessRule
-
-const std::vector<Vec2> ChessRule::validKnightMoves = {
-  { +1, +2 },
-  { +2, +1 },
-  { +2, -1 },
-  { +1, -2 },
-  { -1, +2 },
-  { -2, +1 },
-  { -2, -1 },
-  { -1, -2 }
-};
+  const int s = board.posToIndex(start), t = board.posToIndex(dest);
+  q.push_back(s);
+  visited.insert(s);
+  prev[s] = -1;
+  bool found = false;
+  {
+    STATS_PHASE(SEARCH);
+    for (size_t head = 0; head < q.size(); ++head) {
+      const int u = q[head];
+      control.tick();
+      STATS_COUNT(EXPANDED);
+      STATS_MAX(MAX_FRONTIER, q.size() - head);
 
-// A helper class to store the vertex states of breadth first search.
-class Board {
- public:
-  // Coordinate system:
-  // ---> x(width)
-  // |
-  // V
-  // y(depth)
-  Board(int depth, int width): depth_(depth), width_(width) {
-    if (depth_ <= 0) throw std::runtime_error("Board.depth_ must > 0");
-    if (width_ <= 0) throw std::runtime_error("Board.width_ must > 0");
-    reset();
-  }
+      if (u == t) {
+        found = true;
+        break;
+      }
 
-  // Reset to clean state
-  inline void reset() {
-    const int n = depth_ * width_;
-    visited_.resize(n, false);
-    prev_.resize(n, -1);
+      // Foeach neighbor v of u, if not visited, put it on the queue.
+      board.forEachNeighbor(u, [&](int v, int) {
+        STATS_COUNT(RELAXED);
+        if (!visited.contains(v)) {
+          visited.insert(v);
+          prev[v] = u;
+          q.push_back(v);
+        }
+      });
+    }
   }
+  if (!found) return false;
 
-  // Return whether the vertex u is visited or not.
-  inline bool getVisited(const Vec2& u) const {
-    return visited_[posToIndex(u)];
+  // Output the move sequence by reverse tracing the prev vertices.
+  STATS_PHASE(RECONSTRUCT);
+  for (int cur = t; prev[cur] >= 0; cur = prev[cur]) {
+    moves.push_back(board.indexToPos(cur) - board.indexToPos(prev[cur]));
   }
+  std::reverse(moves.begin(), moves.end());
+  return true;
+}
 
-  // Set whether the vertex u is visited or not.
-  inline void setVisited(const Vec2& u, bool visited) {
-    visited_[posToIndex(u)] = visited;
-  }
+struct MoveResult {
+  bool found_;
+  std::vector<Vec2> moves_;
+  MoveResult(): found_(false), moves_(0) {}
+};
 
-  // Return the prev vertex on the bfs path for vertex u. User is
-  // responsible to call hasPrev to check whether u has prev vertex
-  // before calling this.
-  inline Vec2 getPrev(const Vec2& u) const {
-    return indexToPos(prev_[posToIndex(u)]);
-  }
+// Find a shortest path from start to end, appending its moves to
+// moves. Return false if there is none. Throws SearchCancelled if
+// control is cancelled or its deadline passes.
+bool findMoves(SearchContext& context, const Vec2& start, const Vec2& end,
+               std::vector<Vec2>& moves, SearchControl& control) {
+  const Board& board = context.board_;
+  if (!board.isInside(start) || !board.isInside(end)) return false;
 
-  // Return true if vertex u has prev vertex on the bfs path.
-  inline bool hasPrev(const Vec2& u) const {
-    return prev_[posToIndex(u)] >= 0;
-  }
+  // No path, known without a search.
+  if (!context.components_.isConnected(board.posToIndex(start), board.posToIndex(end))) return false;
+  return bfs(start, end, context, moves, control);
+}
 
-  // Set the prev vertex on the bfs path to u for vertex v
-  inline void setPrev(const Vec2& v, const Vec2& u) {
-    prev_[posToIndex(v)] = posToIndex(u);
-  }
+MoveResult findMoves(SearchContext& context, const Vec2& start, const Vec2& end,
+                     SearchControl& control) {
+  MoveResult result;
+  result.found_ = findMoves(context, start, end, result.moves_, control);
+  return result;
+}
 
-  inline bool isInside(const Vec2& pos) const {
-    return pos.x_ >= 0 && pos.x_ < width_ && pos.y_ >= 0 && pos.y_ < depth_;
+MoveResult findMoves(int depth, int width, const Vec2& start, const Vec2& end,
+                     SearchControl& control) {
+  std::unique_ptr<SearchContext> context;
+  {
+    STATS_PHASE(BUILD);
+    context.reset(new SearchContext(depth, width));
   }
+  return findMoves(*context, start, end, control);
+}
 
- private:
-  int depth_, width_;
-  std::vector<bool> visited_;
-  std::vector<int> prev_;
-
-  // map 2d coordinate on the board to the index in states array.
-  inline int posToIndex(const Vec2& u) const { return u.y_ * width_ + u.x_; }
-
-  // map the index in states array to the 2d coordinate on the board
-  inline Vec2 indexToPos(int i) const { return Vec2(i % width_, i / width_); }
-
-}; // class Board
-
-// Bread first search for a shortest path from u to dest.
-bool bfs(const Vec2& start, const Vec2& dest, Board& board, std::vector<Vec2>& moves) {
-  std::queue<Vec2> q;
-  q.push(start);
-
-  board.reset();
-  while (!q.empty()) {
-    Vec2 u = q.front();
-    q.pop();
-
-    if (u == dest) {
-      // Output the move sequence by reverse tracing the prev
-      // vertices.
-      Vec2 cur = dest;
-      while (board.hasPrev(cur)) {
-        Vec2 prev = board.getPrev(cur);
-        Vec2 move = cur - prev;
-        moves.push_back(move);
-        cur = prev;
+// Solves queries in a canonical orientation of the board and caches
+// the results, so a mirrored or rotated query is answered by mapping
+// the cached moves back instead of searching again. The search context
+// is kept while the board size does not change.
+class CanonicalSolver {
+ public:
+  MoveResult findMoves(int depth, int width, const Vec2& start, const Vec2& end,
+                       SearchControl& control) {
+    // Pick the symmetry that maps (start, end) to the smallest pair.
+    std::vector<Symmetry> symmetries = Symmetry::all(depth, width);
+    Symmetry canonical = symmetries[0];
+    Key key = makeKey(depth, width, start, end);
+    for (auto s: symmetries) {
+      Key k = makeKey(depth, width, s.apply(start), s.apply(end));
+      if (k < key) {
+        key = k;
+        canonical = s;
       }
-      std::reverse(moves.begin(), moves.end());
-      return true;
     }
 
-    // Foeach neighbor v of u, if not visited, put it on the queue.
-    for (auto move: ChessRule::validKnightMoves) {
-      Vec2 v = u + move;
-      if (board.isInside(v) && !board.getVisited(v)) {
-        q.push(v);
-        board.setPrev(v, u);
+    std::map<Key, MoveResult>::const_iterator it = cache_.find(key);
+    if (it == cache_.end()) {
+      if (!context_ || context_->board_.getDepth() != depth ||
+          context_->board_.getWidth() != width) {
+        STATS_PHASE(BUILD);
+        context_.reset(new SearchContext(depth, width));
       }
+      // Bound the memory of a long running solver.
+      if (cache_.size() >= MAX_CACHED) cache_.clear();
+
+      const MoveResult solved =
+          ::findMoves(*context_, canonical.apply(start), canonical.apply(end), control);
+      it = cache_.insert(std::make_pair(key, solved)).first;
     }
 
-    board.setVisited(u, true);
+    // Map the canonical moves back to the original orientation.
+    MoveResult result = it->second;
+    const Symmetry back = canonical.inverse();
+    for (auto& move: result.moves_) {
+      move = Knight::move(back.applyToMoveIndex(Knight::moveIndex(move)));
+    }
+    return result;
   }
 
-  return false;
+ private:
+  typedef std::tuple<int, int, int, int, int, int> Key;
+  static const size_t MAX_CACHED = 1 << 16;
+  std::map<Key, MoveResult> cache_;
+  std::unique_ptr<SearchContext> context_;
+
+  static Key makeKey(int depth, int width, const Vec2& start, const Vec2& end) {
+    return Key(depth, width, start.y_, start.x_, end.y_, end.x_);
+  }
+
+}; // class CanonicalSolver
+
+// Server mode, a request is <depth> <width> <startX> <startY> <endX>
+// <endY>, answered within timeout milliseconds (no limit if 0). Each
+// connection has its own solver.
+Handler makeHandler(int timeout) {
+  std::shared_ptr<CanonicalSolver> solver(new CanonicalSolver);
+  return [solver, timeout](const std::vector<int>& request, std::vector<int>& response) {
+    if (request.size() != 6) {
+      response.push_back(BAD_REQUEST);
+      return;
+    }
+    SearchControl control;
+    control.setTimeout(timeout);
+    MoveResult result;
+    try {
+      result = solver->findMoves(request[0], request[1], Vec2(request[2], request[3]),
+                                 Vec2(request[4], request[5]), control);
+    } catch (const SearchCancelled&) {
+      response.push_back(TIMEOUT);
+      return;
+    }
+    if (!result.found_) {
+      response.push_back(NO_PATH);
+    } else {
+      appendMoves(result.moves_.size(), result.moves_, response);
+    }
+  };
 }
 
-struct MoveResult {
-  bool found_;
-  std::vector<Vec2> moves_;
-  MoveResult(): found_(false), moves_(0) {}
-};
+// Batch mode, a query is <depth> <width> <startX> <startY> <endX>
+// <endY>, answered within timeout milliseconds (no limit if 0). Each
+// thread keeps its search context while the board size does not
+// change, and its move vector.
+Worker makeWorker(int timeout) {
+  struct State {
+    std::unique_ptr<SearchContext> context_;
+    std::vector<Vec2> moves_;
+  };
+  std::shared_ptr<State> state(new State);
+  return [state, timeout](const std::vector<int>& query, std::string& out) {
+    if (query.size() != 6) {
+      out += "BAD_REQUEST\n";
+      return;
+    }
+    const int depth = query[0], width = query[1];
+    std::unique_ptr<SearchContext>& context = state->context_;
+    if (!context || context->board_.getDepth() != depth || context->board_.getWidth() != width) {
+      STATS_PHASE(BUILD);
+      context.reset(new SearchContext(depth, width));
+    }
 
-MoveResult findMoves(int depth, int width, const Vec2& start, const Vec2& end) {
-  MoveResult result;
-  Board board(depth, width);
-  result.found_ = bfs(start, end, board, result.moves_);
-  return result;
+    state->moves_.clear();
+    SearchControl control;
+    control.setTimeout(timeout);
+    bool found;
+    try {
+      found = findMoves(*context, Vec2(query[2], query[3]), Vec2(query[4], query[5]), state->moves_,
+                        control);
+    } catch (const SearchCancelled&) {
+      out += "TIMEOUT\n";
+      return;
+    }
+    if (!found) {
+      out += "NULL\n";
+    } else {
+      appendMoveLines(state->moves_, out);
+    }
+  };
 }
 
 int main(int argc, char* argv[]) {
-  std::string line;
-  std::getline(std::cin, line);
-  std::stringstream iss(line);
+  // l3 [--deadline <ms>] ...
+  const int timeout = parseDeadline(argc, argv);
+
+  // l3 --batch [threads]
+  if (argc >= 2 && std::string(argv[1]) == "--batch") {
+    std::ios::sync_with_stdio(false);
+    const int numThreads = argc >= 3 ? std::atoi(argv[2]) : std::thread::hardware_concurrency();
+    runBatch(std::cin, std::cout, numThreads, [timeout]() { return makeWorker(timeout); });
+    return 0;
+  }
+
+  // l3 --serve <socket>
+  if (argc >= 3 && std::string(argv[1]) == "--serve") {
+    serve(argv[2], [timeout]() { return makeHandler(timeout); });
+    return 0;
+  }
+
+  // l3 --reach <k>, reads <depth> <width> <startX> <startY>
+  if (argc >= 3 && std::string(argv[1]) == "--reach") {
+    int depth, width;
+    Vec2 start;
+    std::cin >> depth >> width >> start.x_ >> start.y_;
+    const Reach reach(depth, width);
+    std::vector<int> heatmap;
+    SearchControl control;
+    control.setTimeout(timeout);
+    int count;
+    try {
+      count = reach.withinMoves(start, std::atoi(argv[2]), control, &heatmap).count();
+    } catch (const SearchCancelled&) {
+      std::cout << "TIMEOUT\n";
+      return 3;
+    }
+    FdWriter out(STDOUT_FILENO);
+    out.putInt(count, false);
+    out.put('\n');
+    reach.writeHeatmap(heatmap, out);
+    return 0;
+  }
+
+  // l3 --all-shortest <n>, reads a single query
+  if (argc >= 3 && std::string(argv[1]) == "--all-shortest") {
+    int depth, width;
+    Vec2 start, end;
+    std::cin >> depth >> width >> start.x_ >> start.y_ >> end.x_ >> end.y_;
+    const KnightMap map(depth, width);
+    if (!map.isInside(start) || !map.isInside(end)) {
+      throw std::runtime_error("start or end out of board.");
+    }
+
+    ShortestPathDag dag(map);
+    SearchControl control;
+    control.setTimeout(timeout);
+    uint64_t count;
+    try {
+      count = dag.build(start, end, control);
+    } catch (const SearchCancelled&) {
+      std::cout << "TIMEOUT\n";
+      return 3;
+    }
+    FdWriter out(STDOUT_FILENO);
+    writeShortestPaths(dag, count, std::atoi(argv[2]), false, out);
+    return 0;
+  }
+
+  // l3 [--binary]
+  const bool binary = argc >= 2 && std::string(argv[1]) == "--binary";
+
   int depth, width;
   Vec2 start, end;
-  bool verbose;
-  iss >> depth >> width;
-  iss >> start.x_ >> start.y_;
-  iss >> end.x_ >> end.y_;
-
-  MoveResult result = findMoves(depth, width, start, end);
-
-  if (!result.found_) {
-    std::cout << "NULL\n";
-  } else {
-    std::cout << std::showpos;
-    for (auto move : result.moves_) {
-      std::cout << move.x_ << "\t" << move.y_ << "\n";
-    }
+  {
+    STATS_PHASE(PARSE);
+    std::string line;
+    std::getline(std::cin, line);
+    std::stringstream iss(line);
+    iss >> depth >> width;
+    iss >> start.x_ >> start.y_;
+    iss >> end.x_ >> end.y_;
   }
+
+  CanonicalSolver solver;
+  SearchControl control;
+  control.setTimeout(timeout);
+  MoveResult result;
+  try {
+    result = solver.findMoves(depth, width, start, end, control);
+  } catch (const SearchCancelled&) {
+    std::cout << "TIMEOUT\n";
+    return 3;
+  }
+
+  STATS_PHASE(PRINT);
+  FdWriter out(STDOUT_FILENO);
+  writeResult(result.found_, false, 0, result.moves_, binary, out);
 }
@@ -1,439 +1,1105 @@
 #include <vector>
+#include <map>
 #include <set>
+#include <memory>
 #include <sstream>
+#include <fstream>
 #include <iostream>
 #include <ios>
 #include <iomanip>
+#include <functional>
+
+#include "knight.h"
+#include "knight_map.h"
+#include "tile_file.h"
+#include "server.h"
+#include "batch.h"
+#include "stats.h"
+#include "output.h"
+#include "control.h"
+#include "reach.h"
+#include "landmarks.h"
+#include "path_dag.h"
+
+// A helper class to store the vertex states during search, indexed
+// like the cells of the map's Board. Only the vertices reached since
+// the last reset have a distance, so reset costs O(1) and a StateBoard
+// can be reused from one search to the next.
+class StateBoard {
+ public:
+  StateBoard(const Board& board):
+      board_(board), reached_(board, false), prev_(board.size(), -1), dist_(board.size(), -1) {}
 
-// Simple vector class representing position on the board as well as
-// movement.
-struct Vec2 {
-  int x_, y_;
-  Vec2(int x, int y): x_(x), y_(y) {}
-  Vec2(): x_(0), y_(0) {}
-};
+  // Reset to clean state
+  inline void reset() { reached_.reset(); }
 
-std::ostream& operator<<(std::ostream& to, const Vec2& v) {
-  return to << "(" << v.x_ << ", " << v.y_ << ")";
-}
+  // Scratch space for the priority queue of a search, kept to avoid
+  // allocations.
+  typedef std::pair<int, int> Entry;
+  inline std::vector<Entry>& getQueue() { return queue_; }
 
-// Comparator, used in std::find
-bool operator==(const Vec2& v1, const Vec2& v2) {
-  return v1.x_ == v2.x_ && v1.y_ == v2.y_;
-}
+  // Return the prev vertex on the path for vertex u. User is
+  // responsible to call hasPrev to check whether u has prev vertex
+  // before calling this.
+  inline int getPrev(int u) const { return prev_[u]; }
 
-// Sum
-Vec2 operator+(const Vec2& v1, const Vec2& v2) {
-  return Vec2(v1.x_ + v2.x_, v1.y_ + v2.y_);
-}
+  // Return true if vertex u has prev vertex on the path.
+  inline bool hasPrev(int u) const { return reached_.contains(u) && prev_[u] >= 0; }
 
-// Substract
-Vec2 operator-(const Vec2& v1, const Vec2& v2) {
-  return Vec2(v1.x_ - v2.x_, v1.y_ - v2.y_);
-}
+  // Set the prev vertex on the path to u for vertex v, v must have a
+  // distance.
+  inline void setPrev(int v, int u) { prev_[v] = u; }
 
-// A class encapsulate the rule the a knight must follow. At any
-// point, a knight might have 8 potential moves.
-class ChessRule {
- public:
-  // Since the set of valid moves is very small (only 8 elements), use
-  // std::vector is efficient even for linear search.
-  static const std::vector<Vec2> validKnightMoves;
+  // Return the distance of vertex u, -1 means infinity.
+  inline int getDist(int u) const { return reached_.contains(u) ? dist_[u] : -1; }
 
-  static bool isValidKnightMove(const Vec2& move) {
-    return std::find(validKnightMoves.begin(), validKnightMoves.end(), move) !=
-        validKnightMoves.end();
+  // Set distance for vertex u. A vertex reached for the first time has
+  // no prev vertex.
+  inline void setDist(int u, int d) {
+    if (!reached_.contains(u)) {
+      reached_.insert(u);
+      prev_[u] = -1;
+    }
+    dist_[u] = d;
   }
-}; // class ChessRule
-
-const std::vector<Vec2> ChessRule::validKnightMoves = {
-  { +1, +2 },
-  { +2, +1 },
-  { +2, -1 },
-  { +1, -2 },
-  { -1, +2 },
-  { -2, +1 },
-  { -2, -1 },
-  { -1, -2 }
-};
 
-// A class for graph queries.
-class KnightMap {
- public:
-  enum CellType { DEFAULT = 0, WATER, ROCK, BARRIER, TELEPORT, LAVA };
-
-  KnightMap(int depth, int width): depth_(depth), width_(width) {
-    reset();
+  friend std::ostream& operator<<(std::ostream& to, const StateBoard& board) {
+    for (int y = 0; y < board.board_.getDepth(); ++y) {
+      for (int x = 0; x < board.board_.getWidth(); ++x) {
+        to << std::setw(6) << board.getDist(board.board_.posToIndex(Vec2(x, y))) << " ";
+      }
+      to << "\n";
+    }
+    return to;
   }
 
-  KnightMap(): KnightMap(0, 0) {}
-
-  // Read from istream
-  friend std::istream& operator>>(std::istream& from, KnightMap& map) {
-    std::ostringstream oss;
-    std::string line;
-    std::vector<CellType> cells;
-    std::set<int> teleports;
-    int width = -1, depth = 0;
-    while (std::getline(std::cin, line)) {
-      std::stringstream iss(line);
-      char c;
-      int widthThisRow = 0;
-      while (iss >> c) {
-        switch (c) {
-          case '.':
-            cells.push_back(DEFAULT); break;
-          case 'W':
-            cells.push_back(WATER); break;
-          case 'R':
-            cells.push_back(ROCK); break;
-          case 'B':
-            cells.push_back(BARRIER); break;
-          case 'T':
-            cells.push_back(TELEPORT);
-            teleports.insert(cells.size() - 1);
-            break;
-          case 'L':
-            cells.push_back(LAVA); break;
-          default:
-            oss.str("");
-            oss << "Unknown cell " << c << ".";
-            throw std::runtime_error(oss.str());
-        }
-        ++widthThisRow;
-      }
+ protected:
+  Board board_;
+  StampedSet reached_;
+  std::vector<int> prev_;
+  std::vector<int> dist_;
+  std::vector<Entry> queue_;
 
-      // First row, do not check width, set it.
-      if (width <= 0) width = widthThisRow;
+}; // class StateBoard
 
-      if (widthThisRow != width) {
-        oss.str("");
-        oss << "At row " << depth << ", width is " << widthThisRow << ", ";
-        oss << "but previous row width is " << width << ".";
-        throw std::runtime_error(oss.str());
-      }
+// Dijkstra's algorithm for shortest path. Return false if no path
+// found. Min priority queue is a binary heap of (dist, vertex) pairs
+// kept by the StateBoard, so once it has grown a search allocates
+// nothing. A vertex whose distance decreases is pushed again, its
+// stale entry is skipped when popped.
+bool dijkstra(const Vec2& start, const Vec2& dest, const KnightMap& map,
+              StateBoard& board, std::vector<Vec2>& moves, int& dist, SearchControl& control) {
+  typedef StateBoard::Entry Entry;
+  std::vector<Entry>& q = board.getQueue();
+  const std::greater<Entry> later;
 
-      ++depth;
+  board.reset();
+  q.clear();
+  const int s = map.posToIndex(start), t = map.posToIndex(dest);
+  // No path, known without a search.
+  if (!map.mayReach(s, t)) return false;
+  board.setDist(s, 0);
+  q.push_back(Entry(0, s));
+  STATS_COUNT(PUSHES);
+
+  {
+    STATS_PHASE(SEARCH);
+    while (!q.empty()) {
+      STATS_MAX(MAX_FRONTIER, q.size());
+      std::pop_heap(q.begin(), q.end(), later);
+      const int uDist = q.back().first, u = q.back().second;
+      q.pop_back();
+      STATS_COUNT(POPS);
+      if (uDist > board.getDist(u)) continue;
+      control.tick();
+      STATS_COUNT(EXPANDED);
+
+      // dest is settled, its distance is final.
+      if (u == t) break;
+
+      map.adj(u, [&](int v) {
+        STATS_COUNT(RELAXED);
+        const int oldDist = board.getDist(v);
+        const int newDist = uDist + map.edgeWeight(u, v);
+        if (oldDist == -1 || newDist < oldDist) {
+          if (oldDist != -1) STATS_COUNT(DECREASE_KEYS);
+          board.setDist(v, newDist);
+          board.setPrev(v, u);
+          q.push_back(Entry(newDist, v));
+          std::push_heap(q.begin(), q.end(), later);
+          STATS_COUNT(PUSHES);
+        }
+      });
     }
-    map.width_ = width;
-    map.depth_ = depth;
-    std::swap(map.cells_, cells);
-    std::swap(map.teleports_, teleports);
-    return from;
   }
 
-  friend std::ostream& operator<<(std::ostream& to, const KnightMap& map) {
-    for (int y = 0, depth = map.getDepth(); y < depth; ++y) {
-      for (int x = 0, width = map.getWidth(); x < width; ++x) {
-        const Vec2 u(x, y);
-        const CellType type(map.getCellType(u));
-        switch (type) {
-          case DEFAULT: to << ". "; break;
-          case WATER: to << "W "; break;
-          case ROCK: to << "R "; break;
-          case BARRIER: to << "B "; break;
-          case TELEPORT: to << "T "; break;
-          case LAVA: to << "L "; break;
+  // No path.
+  dist = board.getDist(t);
+  if (dist < 0) return false;
+
+  STATS_PHASE(RECONSTRUCT);
+  for (int cur = t; board.hasPrev(cur); cur = board.getPrev(cur)) {
+    moves.push_back(map.indexToPos(cur) - map.indexToPos(board.getPrev(cur)));
+  }
+  std::reverse(moves.begin(), moves.end());
+  return true;
+}
+
+// Dijkstra's algorithm on a map stored out of core. Edge weights are
+// small integers, so the queue is a ring of buckets, one per distance
+// modulo MAX_EDGE_WEIGHT + 1 (Dial's algorithm). The cells of a bucket
+// are sorted by index, which groups them by tile, and expanded tile
+// after tile, so each tile is mapped about once per bucket and in file
+// order. buckets is scratch space kept between searches. Finds the same
+// distance as dijkstra(), and a path of that distance.
+bool externalDijkstra(const Vec2& start, const Vec2& dest, TileFile& map,
+                      std::vector<std::vector<TileFile::Index> >& buckets,
+                      std::vector<Vec2>& moves, int& dist, SearchControl& control) {
+  typedef TileFile::Index Index;
+  const int numBuckets = KnightMap::MAX_EDGE_WEIGHT + 1;
+  buckets.resize(numBuckets);
+  for (auto& bucket : buckets) bucket.clear();
+
+  map.reset();
+  const Index s = map.posToIndex(start), t = map.posToIndex(dest);
+  map.setDist(s, 0);
+  map.setPrev(s, TileFile::NO_PREV);
+  buckets[0].push_back(s);
+  size_t queued = 1;
+
+  std::vector<Index> current;
+  bool found = false;
+  {
+    STATS_PHASE(SEARCH);
+    for (int d = 0; queued > 0 && !found; ++d) {
+      std::vector<Index>& bucket = buckets[d % numBuckets];
+      // Teleport hops cost 0 and refill the bucket being expanded.
+      while (!bucket.empty() && !found) {
+        current.swap(bucket);
+        queued -= current.size();
+        std::sort(current.begin(), current.end());
+        STATS_MAX(MAX_FRONTIER, queued + current.size());
+
+        for (auto u : current) {
+          // Reached again at a shorter distance.
+          if (map.getDist(u) != d) continue;
+          control.tick();
+          STATS_COUNT(EXPANDED);
+
+          // dest is settled, its distance is final.
+          if (u == t) {
+            found = true;
+            break;
+          }
+
+          map.adj(u, [&](Index v, int prev) {
+            STATS_COUNT(RELAXED);
+            const int oldDist = map.getDist(v);
+            const int newDist = d + KnightMap::cellWeight(map.getCellType(v));
+            if (oldDist == -1 || newDist < oldDist) {
+              map.setDist(v, newDist);
+              map.setPrev(v, prev);
+              buckets[newDist % numBuckets].push_back(v);
+              ++queued;
+            }
+          });
         }
+        current.clear();
       }
-      to << "\n";
     }
-    return to;
   }
 
-  inline void reset() {
-    cells_.resize(depth_ * width_, DEFAULT);
-  }
+  // No path.
+  if (!found) return false;
+  dist = map.getDist(t);
 
-  inline int getDepth() const { return depth_; }
+  STATS_PHASE(RECONSTRUCT);
+  for (Index cur = t; map.getPrev(cur) != TileFile::NO_PREV;) {
+    const Index prev = map.prevIndex(cur, map.getPrev(cur));
+    moves.push_back(map.indexToPos(cur) - map.indexToPos(prev));
+    cur = prev;
+  }
+  std::reverse(moves.begin(), moves.end());
+  return true;
+}
 
-  inline int getWidth() const { return width_; }
+struct MoveResult {
+  bool found_;
+  int dist_;
+  std::vector<Vec2> moves_;
+  MoveResult(): found_(false), dist_(-1), moves_(0) {}
+};
 
-  // Return true if the pos is inside the map
-  inline bool isInside(const Vec2& pos) const {
-    return pos.x_ >= 0 && pos.x_ < width_ && pos.y_ >= 0 && pos.y_ < depth_;
-  }
+// Throws SearchCancelled if control is cancelled or its deadline
+// passes.
+MoveResult findMoves(const KnightMap& map, StateBoard& board, const Vec2& start, const Vec2& end,
+                     SearchControl& control) {
+  MoveResult result;
+  result.found_ = dijkstra(start, end, map, board, result.moves_, result.dist_, control);
+  return result;
+}
 
-  inline CellType getCellType(const Vec2& u) const {
-    return cells_[posToIndex(u)];
-  }
+MoveResult findMoves(const KnightMap& map, const Vec2& start, const Vec2& end,
+                     SearchControl& control) {
+  StateBoard board(map.getBoard());
+  return findMoves(map, board, start, end, control);
+}
 
-  inline void setCellType(const Vec2& u, const CellType& type) {
-    const int index = posToIndex(u);
-    cells_[index] = type;
-    if (type == TELEPORT) {
-      teleports_.insert(index);
-    } else {
-      teleports_.erase(index);
+// Solves queries in a canonical orientation of a symmetric map and
+// caches the results, so a mirrored or rotated query is answered by
+// mapping the cached moves back instead of searching again. The
+// StateBoard is reused by every search.
+class CanonicalSolver {
+ public:
+  CanonicalSolver(const KnightMap& map):
+      map_(map), symmetries_(map.symmetries()), board_(map.getBoard()) {}
+
+  // A cancelled search caches nothing.
+  MoveResult findMoves(const Vec2& start, const Vec2& end, SearchControl& control) {
+    // Pick the symmetry that maps (start, end) to the smallest pair.
+    Symmetry canonical = symmetries_[0];
+    Key key = makeKey(start, end);
+    for (auto s: symmetries_) {
+      Key k = makeKey(s.apply(start), s.apply(end));
+      if (k < key) {
+        key = k;
+        canonical = s;
+      }
     }
-  }
 
-  // Return a list of vertices that can be reached from vertex u.
-  std::vector<Vec2> adj(const Vec2& u) const {
-    std::vector<Vec2> neighbors;
+    std::map<Key, MoveResult>::const_iterator it = cache_.find(key);
+    if (it == cache_.end()) {
+      // Bound the memory of a long running solver.
+      if (cache_.size() >= MAX_CACHED) cache_.clear();
 
-    // Regular valid chess knight moves
-    for (auto move: ChessRule::validKnightMoves) {
-      Vec2 v = u + move;
+      const MoveResult solved =
+          ::findMoves(map_, board_, canonical.apply(start), canonical.apply(end), control);
+      it = cache_.insert(std::make_pair(key, solved)).first;
+    }
 
-      // Can not go outside the map
-      if (!isInside(v)) continue;
+    // Map the canonical moves back to the original orientation. A
+    // teleport hop is not a knight move, so map moves as vectors.
+    MoveResult result = it->second;
+    const Symmetry back = canonical.inverse();
+    for (auto& move: result.moves_) move = back.applyToMove(move);
+    return result;
+  }
 
-      // Can not land on ROCK
-      if (getCellType(v) == ROCK) continue;
+ private:
+  typedef std::pair<int, int> Key;
+  static const size_t MAX_CACHED = 1 << 16;
+  const KnightMap& map_;
+  std::vector<Symmetry> symmetries_;
+  StateBoard board_;
+  std::map<Key, MoveResult> cache_;
+
+  Key makeKey(const Vec2& start, const Vec2& end) const {
+    return Key(map_.posToIndex(start), map_.posToIndex(end));
+  }
 
-      // Can not cross or land on BARRIER
-      if (getCellType(v) == BARRIER || isCrossingBarrier(u, move)) continue;
+}; // class CanonicalSolver
 
-      neighbors.push_back(v);
+// Nearest target queries: which of many targets is the cheapest to
+// reach from a start position, or which of many sources reaches an end
+// position the cheapest. Both are one Dijkstra search with every source
+// at distance 0, stopped when the first target is settled. The
+// StateBoard and the set of targets are reused by every search.
+class NearestSearch {
+ public:
+  struct Result {
+    bool found_;
+    // Indices of the source and target of the path in the query.
+    int source_, target_;
+    int dist_;
+    std::vector<Vec2> moves_;
+    Result(): found_(false), source_(-1), target_(-1), dist_(-1) {}
+  };
+
+  NearestSearch(const KnightMap& map):
+      map_(map), board_(map.getBoard()), targets_(map.getBoard(), false) {}
+
+  // Return a cheapest path from one of sources to one of targets, all
+  // of which must be inside the map. Throws SearchCancelled if control
+  // is cancelled or its deadline passes.
+  Result find(const std::vector<Vec2>& sources, const std::vector<Vec2>& targets,
+              SearchControl& control) {
+    typedef StateBoard::Entry Entry;
+    std::vector<Entry>& q = board_.getQueue();
+    const std::greater<Entry> later;
+
+    Result result;
+    board_.reset();
+    targets_.reset();
+    q.clear();
+    for (auto& target : targets) targets_.insert(map_.posToIndex(target));
+    for (auto& source : sources) {
+      const int s = map_.posToIndex(source);
+      // Only the sources that may reach a target.
+      bool mayReach = false;
+      for (auto& target : targets) {
+        if (map_.mayReach(s, map_.posToIndex(target))) {
+          mayReach = true;
+          break;
+        }
+      }
+      if (!mayReach) continue;
+      if (board_.getDist(s) == 0) continue;
+      board_.setDist(s, 0);
+      q.push_back(Entry(0, s));
+      STATS_COUNT(PUSHES);
     }
+    std::make_heap(q.begin(), q.end(), later);
+
+    int t = -1;
+    {
+      STATS_PHASE(SEARCH);
+      while (!q.empty()) {
+        STATS_MAX(MAX_FRONTIER, q.size());
+        std::pop_heap(q.begin(), q.end(), later);
+        const int uDist = q.back().first, u = q.back().second;
+        q.pop_back();
+        STATS_COUNT(POPS);
+        if (uDist > board_.getDist(u)) continue;
+        control.tick();
+        STATS_COUNT(EXPANDED);
+
+        // The first target settled is the nearest.
+        if (targets_.contains(u)) {
+          t = u;
+          break;
+        }
 
-    // teleports
-    std::set<int>::const_iterator it = teleports_.find(posToIndex(u));
-    if (it != teleports_.end()) {
-      for (auto i : teleports_) {
-        if (*it != i) neighbors.push_back(indexToPos(i));
+        map_.adj(u, [&](int v) {
+          STATS_COUNT(RELAXED);
+          const int oldDist = board_.getDist(v);
+          const int newDist = uDist + map_.edgeWeight(u, v);
+          if (oldDist == -1 || newDist < oldDist) {
+            if (oldDist != -1) STATS_COUNT(DECREASE_KEYS);
+            board_.setDist(v, newDist);
+            board_.setPrev(v, u);
+            q.push_back(Entry(newDist, v));
+            std::push_heap(q.begin(), q.end(), later);
+            STATS_COUNT(PUSHES);
+          }
+        });
       }
     }
 
-    // std::cout << "adj of " << u << ": ";
-    // for (auto n: neighbors) std::cout << n << " ";
-    // std::cout << "\n";
+    // No path.
+    if (t < 0) return result;
 
-    return neighbors;
+    STATS_PHASE(RECONSTRUCT);
+    result.found_ = true;
+    result.dist_ = board_.getDist(t);
+    int s = t;
+    for (; board_.hasPrev(s); s = board_.getPrev(s)) {
+      result.moves_.push_back(map_.indexToPos(s) - map_.indexToPos(board_.getPrev(s)));
+    }
+    std::reverse(result.moves_.begin(), result.moves_.end());
+    result.source_ = indexOf(sources, s);
+    result.target_ = indexOf(targets, t);
+    return result;
   }
 
-  // Return the weight for edge (u, v)
-  inline int edgeWeight(const Vec2& u, const Vec2& v) const {
-    const CellType type = getCellType(v);
-    const int NA = 1000;
-    switch (type) {
-      case WATER: return 2;
-      case ROCK: return NA;
-      case BARRIER: return NA;
-      case TELEPORT: return 0;
-      case LAVA: return 5;
-      default:
-        break;
-    }
-    return 1;
+ private:
+  const KnightMap& map_;
+  StateBoard board_;
+  StampedSet targets_;
+
+  int indexOf(const std::vector<Vec2>& positions, int u) const {
+    for (size_t i = 0; i < positions.size(); ++i) {
+      if (map_.posToIndex(positions[i]) == u) return i;
+    }
+    return -1;
   }
 
- protected:
-  int depth_, width_;
-  std::vector<CellType> cells_;
-  std::set<int> teleports_;
-
-  // map 2d coordinate on the board to the index in states array.
-  inline int posToIndex(const Vec2& u) const { return u.y_ * width_ + u.x_; }
-
-  // map the index in states array to the 2d coordinate on the board
-  inline Vec2 indexToPos(int i) const { return Vec2(i % width_, i / width_); }
-
-  // Return true if the move from u crossed a barrier. Prerequisite:
-  // move obey chess rule for knight and v = u + move is still inside
-  // map.
-
-  // The following are the invalid cases for move = (2, 1)
-  // 1)  u B .    2)  u . .   3)  u B .
-  //     . . x        . B x       . B x
-  inline bool isCrossingBarrier(const Vec2& u, const Vec2& move) const {
-    if (move.x_ == 2 || move.x_ == -2) {
-      Vec2 mid1(u.x_ + move.x_ / 2, u.y_), mid2(u.x_ + move.x_ / 2, u.y_ + move.y_);
-      if (getCellType(mid1) == BARRIER || getCellType(mid1) == BARRIER) return true;
-    } else if (move.y_ == 2 || move.y_ == -2) {
-      Vec2 mid1(u.x_, u.y_ + move.y_ / 2), mid2(u.x_ + move.x_, u.y_ + move.y_ / 2);
-      if (getCellType(mid1) == BARRIER || getCellType(mid1) == BARRIER) return true;
+}; // class NearestSearch
+
+// A* search guided by the landmark bounds towards dest. Finds the same
+// distance as dijkstra(), and a path of that distance, expanding the
+// vertices whose distance plus bound is below it. A vertex the bounds
+// show can not reach dest is never queued, so a start that can not
+// reach dest is answered without a search.
+bool altSearch(const Vec2& start, const Vec2& dest, const KnightMap& map,
+               const Landmarks& landmarks, StateBoard& board, std::vector<Vec2>& moves, int& dist,
+               SearchControl& control) {
+  typedef StateBoard::Entry Entry;
+  std::vector<Entry>& q = board.getQueue();
+  const std::greater<Entry> later;
+
+  board.reset();
+  q.clear();
+  const int s = map.posToIndex(start), t = map.posToIndex(dest);
+  if (!map.mayReach(s, t)) return false;
+  const Landmarks::Bound bound = landmarks.towards(t);
+  const int sBound = bound(s);
+  if (sBound < 0) return false;
+  board.setDist(s, 0);
+  q.push_back(Entry(sBound, s));
+  STATS_COUNT(PUSHES);
+
+  {
+    STATS_PHASE(SEARCH);
+    while (!q.empty()) {
+      STATS_MAX(MAX_FRONTIER, q.size());
+      std::pop_heap(q.begin(), q.end(), later);
+      const int uKey = q.back().first, u = q.back().second;
+      q.pop_back();
+      STATS_COUNT(POPS);
+      const int uDist = board.getDist(u);
+      if (uKey > uDist + bound(u)) continue;
+      control.tick();
+      STATS_COUNT(EXPANDED);
+
+      // dest is settled, its distance is final.
+      if (u == t) break;
+
+      map.adj(u, [&](int v) {
+        STATS_COUNT(RELAXED);
+        const int oldDist = board.getDist(v);
+        const int newDist = uDist + map.edgeWeight(u, v);
+        if (oldDist == -1 || newDist < oldDist) {
+          const int vBound = bound(v);
+          if (vBound < 0) return;
+          if (oldDist != -1) STATS_COUNT(DECREASE_KEYS);
+          board.setDist(v, newDist);
+          board.setPrev(v, u);
+          q.push_back(Entry(newDist + vBound, v));
+          std::push_heap(q.begin(), q.end(), later);
+          STATS_COUNT(PUSHES);
+        }
+      });
     }
-    return false;
   }
 
-};
+  // No path.
+  dist = board.getDist(t);
+  if (dist < 0) return false;
 
-// A helper class to store the vertex states during search.
-class StateBoard {
- public:
-  // Coordinate system:
-  // ---> x(width)
-  // |
-  // V
-  // y(depth)
-  StateBoard(int depth, int width): depth_(depth), width_(width) {
-    if (depth_ <= 0) throw std::runtime_error("StateBoard.depth_ must > 0");
-    if (width_ <= 0) throw std::runtime_error("StateBoard.width_ must > 0");
-    reset();
+  STATS_PHASE(RECONSTRUCT);
+  for (int cur = t; board.hasPrev(cur); cur = board.getPrev(cur)) {
+    moves.push_back(map.indexToPos(cur) - map.indexToPos(board.getPrev(cur)));
   }
+  std::reverse(moves.begin(), moves.end());
+  return true;
+}
 
-  // Reset to clean state
-  inline void reset() {
-    const int n = depth_ * width_;
-    prev_.resize(n, -1);
-    dist_.resize(n, -1);
+// Dijkstra's algorithm from dest on the reversed graph. Afterwards,
+// tree.getDist(u) is the distance from u to dest, -1 if dest can not be
+// reached, and tree.getPrev(u) the next vertex of a shortest path from
+// u: tree holds the shortest path tree of dest. ROCK and BARRIER cells
+// get a distance, since a path may start on one, but are not expanded:
+// no path passes through them. Throws SearchCancelled if control is
+// cancelled or its deadline passes.
+void reverseDijkstra(int dest, const KnightMap& map, StateBoard& tree, SearchControl& control) {
+  typedef StateBoard::Entry Entry;
+  std::vector<Entry>& q = tree.getQueue();
+  const std::greater<Entry> later;
+
+  tree.reset();
+  q.clear();
+  tree.setDist(dest, 0);
+  q.push_back(Entry(0, dest));
+
+  while (!q.empty()) {
+    std::pop_heap(q.begin(), q.end(), later);
+    const int vDist = q.back().first, v = q.back().second;
+    q.pop_back();
+    if (vDist > tree.getDist(v)) continue;
+    control.tick();
+
+    map.radj(v, [&](int u) {
+      const int oldDist = tree.getDist(u);
+      const int newDist = vDist + map.edgeWeight(u, v);
+      if (oldDist == -1 || newDist < oldDist) {
+        tree.setDist(u, newDist);
+        tree.setPrev(u, v);
+        const KnightMap::CellType type = map.getCellType(u);
+        if (type == KnightMap::ROCK || type == KnightMap::BARRIER) return;
+        q.push_back(Entry(newDist, u));
+        std::push_heap(q.begin(), q.end(), later);
+      }
+    });
   }
+}
 
-  // Return the prev vertex on the bfs path for vertex u. User is
-  // responsible to call hasPrev to check whether u has prev vertex
-  // before calling this.
-  inline Vec2 getPrev(const Vec2& u) const {
-    return indexToPos(prev_[posToIndex(u)]);
+// The K cheapest simple paths between two vertices, by Yen's algorithm:
+// the i-th path is the cheapest of the candidates made of a prefix (the
+// root) of the (i-1)-th path and a spur path avoiding the root and the
+// edges taken after the root by the paths found so far.
+//
+// The shortest path tree of dest is computed once per query. Its
+// distances to dest are exact, so each spur search is an A* search
+// with them as heuristic (they only grow when vertices and edges are
+// removed, so stay admissible), and it stops as soon as it reaches a
+// vertex whose tree path avoids the removed vertices.
+class KShortestPaths {
+ public:
+  KShortestPaths(const KnightMap& map):
+      map_(map), tree_(map.getBoard()), search_(map.getBoard()),
+      blocked_(map.getBoard(), false), failed_(map.getBoard(), false) {}
+
+  // Return the k cheapest simple paths from start to end, cheapest
+  // first. Fewer if there are fewer paths. Throws SearchCancelled if
+  // control is cancelled or its deadline passes.
+  std::vector<MoveResult> find(const Vec2& start, const Vec2& end, int k, SearchControl& control) {
+    std::vector<MoveResult> results;
+    const int s = map_.posToIndex(start), t = map_.posToIndex(end);
+    if (k <= 0 || !map_.mayReach(s, t)) return results;
+    reverseDijkstra(t, map_, tree_, control);
+    if (tree_.getDist(s) < 0) return results;
+
+    // Paths found, as vertices, and candidates by distance.
+    std::vector<Path> found(1);
+    treePath(s, t, found[0]);
+    std::set<std::pair<int, Path> > candidates;
+    std::set<Path> seen;
+    seen.insert(found[0]);
+    results.push_back(toResult(tree_.getDist(s), found[0]));
+
+    std::vector<int> blockedNext;
+    Path spurPath, candidate;
+    while (static_cast<int>(found.size()) < k) {
+      const Path& last = found.back();
+      int rootDist = 0;
+      for (size_t j = 0; j + 1 < last.size(); ++j) {
+        // Edges leaving the spur vertex along paths with the same root.
+        blockedNext.clear();
+        for (auto& path : found) {
+          if (path.size() > j + 1 && std::equal(last.begin(), last.begin() + j + 1, path.begin())) {
+            blockedNext.push_back(path[j + 1]);
+          }
+        }
+        blocked_.reset();
+        for (size_t i = 0; i < j; ++i) blocked_.insert(last[i]);
+
+        int spurDist;
+        if (spur(last[j], t, blockedNext, spurPath, spurDist, control)) {
+          candidate.assign(last.begin(), last.begin() + j);
+          candidate.insert(candidate.end(), spurPath.begin(), spurPath.end());
+          if (seen.insert(candidate).second) {
+            candidates.insert(std::make_pair(rootDist + spurDist, candidate));
+          }
+        }
+        rootDist += map_.edgeWeight(last[j], last[j + 1]);
+      }
+
+      if (candidates.empty()) break;
+      found.push_back(candidates.begin()->second);
+      results.push_back(toResult(candidates.begin()->first, found.back()));
+      candidates.erase(candidates.begin());
+    }
+    return results;
   }
 
-  // Return true if vertex u has prev vertex on the bfs path.
-  inline bool hasPrev(const Vec2& u) const {
-    return prev_[posToIndex(u)] >= 0;
+ private:
+  typedef std::vector<int> Path;
+  const KnightMap& map_;
+  // Shortest path tree of dest, and the state of spur searches.
+  StateBoard tree_, search_;
+  // Root vertices of a spur search, and vertices whose tree path is
+  // known to pass through one.
+  StampedSet blocked_, failed_;
+  std::vector<int> walked_;
+
+  // Store the vertices of the tree path from u to t in path.
+  void treePath(int u, int t, Path& path) const {
+    path.assign(1, u);
+    for (; u != t; u = tree_.getPrev(u)) path.push_back(tree_.getPrev(u));
   }
 
-  // Set the prev vertex on the bfs path to u for vertex v
-  inline void setPrev(const Vec2& v, const Vec2& u) {
-    prev_[posToIndex(v)] = posToIndex(u);
+  // Return true if the tree path from u avoids the blocked vertices
+  // and from.
+  bool isTreePathFree(int u, int from, int t) {
+    walked_.clear();
+    for (int cur = u;; cur = tree_.getPrev(cur)) {
+      if (cur == from || blocked_.contains(cur) || failed_.contains(cur)) {
+        for (auto v : walked_) failed_.insert(v);
+        return false;
+      }
+      walked_.push_back(cur);
+      if (cur == t) return true;
+    }
   }
 
-  // Return the distance of vertex u.
-  inline int getDist(const Vec2& u) const {
-    return dist_[posToIndex(u)];
+  // A* search from u to t avoiding the blocked vertices and the edges
+  // from u to blockedNext. Store the vertices of the path found in path
+  // and its distance in dist.
+  bool spur(int u, int t, const std::vector<int>& blockedNext, Path& path, int& dist,
+            SearchControl& control) {
+    typedef StateBoard::Entry Entry;
+    std::vector<Entry>& q = search_.getQueue();
+    const std::greater<Entry> later;
+
+    search_.reset();
+    failed_.reset();
+    q.clear();
+    search_.setDist(u, 0);
+    q.push_back(Entry(tree_.getDist(u), u));
+
+    while (!q.empty()) {
+      std::pop_heap(q.begin(), q.end(), later);
+      const int estimate = q.back().first, v = q.back().second;
+      q.pop_back();
+      const int vDist = search_.getDist(v);
+      if (estimate > vDist + tree_.getDist(v)) continue;
+      control.tick();
+
+      // The rest of a cheapest path follows the tree.
+      if (v == t || (v != u && isTreePathFree(v, u, t))) {
+        path.clear();
+        for (int cur = v; cur != u; cur = search_.getPrev(cur)) path.push_back(cur);
+        path.push_back(u);
+        std::reverse(path.begin(), path.end());
+        for (int cur = v; cur != t;) {
+          cur = tree_.getPrev(cur);
+          path.push_back(cur);
+        }
+        dist = vDist + tree_.getDist(v);
+        return true;
+      }
+
+      map_.adj(v, [&](int w) {
+        if (blocked_.contains(w) || tree_.getDist(w) < 0) return;
+        if (v == u && std::find(blockedNext.begin(), blockedNext.end(), w) != blockedNext.end()) return;
+        const int oldDist = search_.getDist(w);
+        const int newDist = vDist + map_.edgeWeight(v, w);
+        if (oldDist == -1 || newDist < oldDist) {
+          search_.setDist(w, newDist);
+          search_.setPrev(w, v);
+          q.push_back(Entry(newDist + tree_.getDist(w), w));
+          std::push_heap(q.begin(), q.end(), later);
+        }
+      });
+    }
+    return false;
   }
 
-  // Set distance for vertex u.
-  inline void setDist(const Vec2& u, int d) {
-    dist_[posToIndex(u)] = d;
+  MoveResult toResult(int dist, const Path& path) const {
+    MoveResult result;
+    result.found_ = true;
+    result.dist_ = dist;
+    for (size_t i = 0; i + 1 < path.size(); ++i) {
+      result.moves_.push_back(map_.indexToPos(path[i + 1]) - map_.indexToPos(path[i]));
+    }
+    return result;
   }
 
-  friend std::ostream& operator<<(std::ostream& to, const StateBoard& board) {
-    for (int y = 0; y < board.depth_; ++y) {
-      for (int x = 0; x < board.width_; ++x) {
-        to << std::setw(6) << board.dist_[board.posToIndex(Vec2(x, y))] << " ";
-      }
-      to << "\n";
+}; // class KShortestPaths
+
+// Server mode, a request is <map> <startX> <startY> <endX> <endY>,
+// where map is the index of the map in the command line, answered
+// within timeout milliseconds (no limit if 0). Each connection has its
+// own solvers.
+Handler makeHandler(const std::vector<KnightMap>& maps, int timeout) {
+  typedef std::vector<std::unique_ptr<CanonicalSolver> > Solvers;
+  std::shared_ptr<Solvers> solvers(new Solvers(maps.size()));
+  return [&maps, solvers, timeout](const std::vector<int>& request, std::vector<int>& response) {
+    if (request.size() != 5 || request[0] < 0 || request[0] >= static_cast<int>(maps.size())) {
+      response.push_back(BAD_REQUEST);
+      return;
     }
-    return to;
+    const KnightMap& map = maps[request[0]];
+    const Vec2 start(request[1], request[2]), end(request[3], request[4]);
+    if (!map.isInside(start) || !map.isInside(end)) {
+      response.push_back(BAD_REQUEST);
+      return;
+    }
+
+    std::unique_ptr<CanonicalSolver>& solver = (*solvers)[request[0]];
+    if (!solver) solver.reset(new CanonicalSolver(map));
+    SearchControl control;
+    control.setTimeout(timeout);
+    MoveResult result;
+    try {
+      result = solver->findMoves(start, end, control);
+    } catch (const SearchCancelled&) {
+      response.push_back(TIMEOUT);
+      return;
+    }
+    if (!result.found_) {
+      response.push_back(NO_PATH);
+    } else {
+      appendMoves(result.dist_, result.moves_, response);
+    }
+  };
+}
+
+// Batch mode, a query is <startX> <startY> <endX> <endY> on the map
+// loaded once, answered within timeout milliseconds (no limit if 0).
+// Each thread keeps its StateBoard and move vector.
+Worker makeWorker(const KnightMap& map, int timeout) {
+  struct State {
+    StateBoard board_;
+    std::vector<Vec2> moves_;
+    State(const Board& board): board_(board) {}
+  };
+  std::shared_ptr<State> state(new State(map.getBoard()));
+  return [&map, state, timeout](const std::vector<int>& query, std::string& out) {
+    const Vec2 start(query.size() == 4 ? Vec2(query[0], query[1]) : Vec2(-1, -1));
+    const Vec2 end(query.size() == 4 ? Vec2(query[2], query[3]) : Vec2(-1, -1));
+    if (!map.isInside(start) || !map.isInside(end)) {
+      out += "BAD_REQUEST\n";
+      return;
+    }
+
+    int dist;
+    state->moves_.clear();
+    SearchControl control;
+    control.setTimeout(timeout);
+    bool found;
+    try {
+      found = dijkstra(start, end, map, state->board_, state->moves_, dist, control);
+    } catch (const SearchCancelled&) {
+      out += "TIMEOUT\n";
+      return;
+    }
+    if (!found) {
+      out += "NO_PATH\n";
+    } else {
+      appendInt(dist, false, out);
+      out += '\n';
+      appendMoveLines(state->moves_, out);
+    }
+  };
+}
+
+// Out-of-core mode, a query is <startX> <startY> <endX> <endY> on the
+// map stored in a tile file. Answered by a single worker, which owns the
+// tile file. A query is answered within timeout milliseconds (no limit
+// if 0).
+Worker makeExternalWorker(TileFile& map, int timeout) {
+  typedef std::vector<std::vector<TileFile::Index> > Buckets;
+  std::shared_ptr<Buckets> buckets(new Buckets);
+  std::shared_ptr<std::vector<Vec2> > moves(new std::vector<Vec2>);
+  return [&map, buckets, moves, timeout](const std::vector<int>& query, std::string& out) {
+    const Vec2 start(query.size() == 4 ? Vec2(query[0], query[1]) : Vec2(-1, -1));
+    const Vec2 end(query.size() == 4 ? Vec2(query[2], query[3]) : Vec2(-1, -1));
+    if (!map.isInside(start) || !map.isInside(end)) {
+      out += "BAD_REQUEST\n";
+      return;
+    }
+
+    int dist;
+    moves->clear();
+    SearchControl control;
+    control.setTimeout(timeout);
+    bool found;
+    try {
+      found = externalDijkstra(start, end, map, *buckets, *moves, dist, control);
+    } catch (const SearchCancelled&) {
+      out += "TIMEOUT\n";
+      return;
+    }
+    if (!found) {
+      out += "NO_PATH\n";
+    } else {
+      appendInt(dist, false, out);
+      out += '\n';
+      appendMoveLines(*moves, out);
+    }
+  };
+}
+
+int main(int argc, char* argv[]) {
+  // l4 [--deadline <ms>] ...
+  const int timeout = parseDeadline(argc, argv);
+
+  // l4 --reach <k>, l4 --reach-cost <budget>, reads <startX> <startY>
+  // and the map
+  if (argc >= 3 && (std::string(argv[1]) == "--reach" || std::string(argv[1]) == "--reach-cost")) {
+    Vec2 start;
+    KnightMap map;
+    std::string line;
+    std::getline(std::cin, line);
+    std::stringstream iss(line);
+    iss >> start.x_ >> start.y_;
+    std::cin >> map;
+
+    const Reach reach(map);
+    std::vector<int> heatmap;
+    const int limit = std::atoi(argv[2]);
+    SearchControl control;
+    control.setTimeout(timeout);
+    int count;
+    try {
+      count = (std::string(argv[1]) == "--reach"
+          ? reach.withinMoves(start, limit, control, &heatmap)
+          : reach.withinCost(start, limit, control, &heatmap)).count();
+    } catch (const SearchCancelled&) {
+      std::cout << "TIMEOUT\n";
+      return 3;
+    }
+    FdWriter out(STDOUT_FILENO);
+    out.putInt(count, false);
+    out.put('\n');
+    reach.writeHeatmap(heatmap, out);
+    return 0;
   }
 
- protected:
-  int depth_, width_;
-  std::vector<int> prev_;
-  std::vector<int> dist_;
+  // l4 --nearest reads <startX> <startY> <x1> <y1> <x2> <y2>... and
+  // the map, l4 --nearest-source reads <endX> <endY> <x1> <y1>...
+  if (argc >= 2 && (std::string(argv[1]) == "--nearest" || std::string(argv[1]) == "--nearest-source")) {
+    std::vector<Vec2> one(1), many;
+    KnightMap map;
+    std::string line;
+    std::getline(std::cin, line);
+    std::stringstream iss(line);
+    iss >> one[0].x_ >> one[0].y_;
+    for (Vec2 pos; iss >> pos.x_ >> pos.y_;) many.push_back(pos);
+    std::cin >> map;
+    if (!map.isInside(one[0])) throw std::runtime_error("start or end out of map.");
+    for (auto& pos : many) {
+      if (!map.isInside(pos)) throw std::runtime_error("target or source out of map.");
+    }
 
-  // map 2d coordinate on the board to the index in states array.
-  inline int posToIndex(const Vec2& u) const { return u.y_ * width_ + u.x_; }
+    const bool toTargets = std::string(argv[1]) == "--nearest";
+    NearestSearch search(map);
+    SearchControl control;
+    control.setTimeout(timeout);
+    NearestSearch::Result result;
+    try {
+      result = toTargets ? search.find(one, many, control) : search.find(many, one, control);
+    } catch (const SearchCancelled&) {
+      std::cout << "TIMEOUT\n";
+      return 3;
+    }
 
-  // map the index in states array to the 2d coordinate on the board
-  inline Vec2 indexToPos(int i) const { return Vec2(i % width_, i / width_); }
+    // The target (or source) found, then the path as a single query.
+    FdWriter out(STDOUT_FILENO);
+    if (result.found_) {
+      const Vec2& pos = many[toTargets ? result.target_ : result.source_];
+      out.putInt(pos.x_, false);
+      out.put(' ');
+      out.putInt(pos.y_, false);
+      out.put('\n');
+    }
+    writeResult(result.found_, true, result.dist_, result.moves_, false, out);
+    return 0;
+  }
 
-}; // class StateBoard
+  // l4 --k-shortest <k>
+  if (argc >= 3 && std::string(argv[1]) == "--k-shortest") {
+    Vec2 start, end;
+    KnightMap map;
+    std::string line;
+    std::getline(std::cin, line);
+    std::stringstream iss(line);
+    iss >> start.x_ >> start.y_ >> end.x_ >> end.y_;
+    std::cin >> map;
+    if (!map.isInside(start) || !map.isInside(end)) {
+      throw std::runtime_error("start or end out of map.");
+    }
 
-// dist = -1 means infinity.
-class ByDist {
- public:
-  ByDist(const StateBoard& board): board_(board) {}
-  bool operator()(const Vec2& u1, const Vec2& u2) const {
-    const int d1 = board_.getDist(u1), d2 = board_.getDist(u2);
+    KShortestPaths paths(map);
+    SearchControl control;
+    control.setTimeout(timeout);
+    std::vector<MoveResult> results;
+    try {
+      results = paths.find(start, end, std::atoi(argv[2]), control);
+    } catch (const SearchCancelled&) {
+      std::cout << "TIMEOUT\n";
+      return 3;
+    }
+    FdWriter out(STDOUT_FILENO);
+    if (results.empty()) out.put("NO_PATH\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+      if (i > 0) out.put('\n');
+      writeResult(true, true, results[i].dist_, results[i].moves_, false, out);
+    }
+    return 0;
+  }
 
-    if (d1 == -1 && d2 >= 0) return false;
+  // l4 --all-shortest <n>
+  if (argc >= 3 && std::string(argv[1]) == "--all-shortest") {
+    Vec2 start, end;
+    KnightMap map;
+    std::string line;
+    std::getline(std::cin, line);
+    std::stringstream iss(line);
+    iss >> start.x_ >> start.y_ >> end.x_ >> end.y_;
+    std::cin >> map;
+    if (!map.isInside(start) || !map.isInside(end)) {
+      throw std::runtime_error("start or end out of map.");
+    }
 
-    if (d1 >= 0 && d2 == -1) return true;
+    ShortestPathDag dag(map);
+    SearchControl control;
+    control.setTimeout(timeout);
+    uint64_t count;
+    try {
+      count = dag.build(start, end, control);
+    } catch (const SearchCancelled&) {
+      std::cout << "TIMEOUT\n";
+      return 3;
+    }
+    FdWriter out(STDOUT_FILENO);
+    writeShortestPaths(dag, count, std::atoi(argv[2]), true, out);
+    return 0;
+  }
 
-    if (d1 == d2) {
-      if (u1.x_ == u2.x_) {
-        return u1.y_ < u2.y_;
-      }
-      return u1.x_ < u2.x_;
+  // l4 --external <map file> <budget MB>
+  if (argc >= 4 && std::string(argv[1]) == "--external") {
+    std::ifstream mapFile(argv[2]);
+    if (!mapFile) throw std::runtime_error(std::string("Can not open ") + argv[2] + ".");
+    std::unique_ptr<TileFile> map;
+    {
+      STATS_PHASE(PARSE);
+      map.reset(new TileFile(mapFile, static_cast<size_t>(std::atoi(argv[3])) << 20));
     }
 
-    return d1 < d2;
+    std::ios::sync_with_stdio(false);
+    runBatch(std::cin, std::cout, 1, [&map, timeout]() { return makeExternalWorker(*map, timeout); });
+    return 0;
   }
- private:
-  const StateBoard& board_;
-};
 
-// Dijkstra's algorithm for shortest path. Return false if no path
-// found. Min priority queue is implemented using balanced binary
-// search tree (std::set).
-bool dijkstra(const Vec2& start, const Vec2& dest, const KnightMap& map,
-              StateBoard& board, std::vector<Vec2>& moves, int& dist) {
-  ByDist comparator(board);
-  std::set<Vec2, ByDist> q(comparator);
+  // l4 --alt <map file> [landmarks]
+  if (argc >= 3 && std::string(argv[1]) == "--alt") {
+    std::ifstream mapFile(argv[2]);
+    if (!mapFile) throw std::runtime_error(std::string("Can not open ") + argv[2] + ".");
+    KnightMap map;
+    {
+      STATS_PHASE(PARSE);
+      mapFile >> map;
+    }
 
-  board.reset();
-  for (int y = 0, depth = map.getDepth(); y < depth; ++y)
-    for (int x = 0, width = map.getWidth(); x < width; ++x)
-      q.insert(Vec2(x, y));
+    // The landmarks are saved next to the map, and computed again when
+    // the map or the landmark count changed.
+    const std::string landmarksPath = std::string(argv[2]) + ".alt";
+    const int landmarkCount = argc >= 4 ? std::atoi(argv[3]) : 8;
+    Landmarks landmarks;
+    if (!landmarks.load(map, landmarksPath, landmarkCount)) {
+      STATS_PHASE(BUILD);
+      landmarks.build(map, landmarkCount);
+      landmarks.save(map, landmarksPath);
+    }
 
-  std::set<Vec2>::const_iterator sIter = q.find(start);
-  q.erase(sIter);
-  board.setDist(start, 0);
-  q.insert(start);
+    // A line is a query <startX> <startY> <endX> <endY>, answered as in
+    // batch mode, or an edit <x> <y> <cell> of the map, answered by the
+    // number of landmark distance arrays computed again.
+    std::ios::sync_with_stdio(false);
+    StateBoard board(map.getBoard());
+    std::vector<Vec2> moves;
+    std::string line, out;
+    while (std::getline(std::cin, line)) {
+      std::stringstream iss(line);
+      Vec2 start, end;
+      std::string cell;
+      out.clear();
+      if (!(iss >> start.x_ >> start.y_)) continue;
+      if (iss >> end.x_ >> end.y_) {
+        if (!map.isInside(start) || !map.isInside(end)) {
+          out += "BAD_REQUEST\n";
+        } else {
+          SearchControl control;
+          control.setTimeout(timeout);
+          int dist;
+          moves.clear();
+          try {
+            if (!altSearch(start, end, map, landmarks, board, moves, dist, control)) {
+              out += "NO_PATH\n";
+            } else {
+              appendInt(dist, false, out);
+              out += '\n';
+              appendMoveLines(moves, out);
+            }
+          } catch (const SearchCancelled&) {
+            out += "TIMEOUT\n";
+          }
+        }
+      } else {
+        iss.clear();
+        try {
+          if (!(iss >> cell) || cell.size() != 1 || !map.isInside(start)) {
+            throw std::runtime_error("Bad edit.");
+          }
+          appendInt(landmarks.setCellType(map, start, KnightMap::parseCell(cell[0])), false, out);
+          out += '\n';
+        } catch (const std::runtime_error&) {
+          out += "BAD_REQUEST\n";
+        }
+      }
+      out += '\n';
+      std::cout << out;
+    }
+    return 0;
+  }
 
-  // std::cout << "q.size: " << q.size() << "\n";
-  while (!q.empty()) {
-    std::set<Vec2>::const_iterator uIter = q.begin();
-    Vec2 u = *uIter;
-    q.erase(uIter);
-    // std::cout << "u: " << u << "\n";
-    // std::cout << "q.size: " << q.size() << "\n";
-    // std::cout << board;
-    // std::cout << "\n";
-
-    const int uDist = board.getDist(u);
-    if (uDist == -1) break;
-
-    for (auto v: map.adj(u)) {
-      const int oldDist = board.getDist(v);
-      const int newDist = uDist + map.edgeWeight(u, v);
-      // std::cout << "edge: " << u << " -> " << v << ", weight: " << map.edgeWeight(u, v) << "\n";
-      // std::cout << "newDist: " << newDist << "\n";
-      if (oldDist == -1 || newDist < oldDist) {
-        // Remove v from sorted set, update its sort key, then insert
-        // it back.
-        std::set<Vec2>::const_iterator vIter = q.find(v);
-        q.erase(vIter);
-        board.setDist(v, newDist);
-        board.setPrev(v, u);
-        q.insert(v);
+  // l4 --components <map file>, a check of the incremental components:
+  // each line of stdin is an edit <x> <y> <cell>, answered by SAME if
+  // the components are those of the map indexed from scratch, DIFFERENT
+  // otherwise, and the number of component labels.
+  if (argc >= 3 && std::string(argv[1]) == "--components") {
+    std::ifstream mapFile(argv[2]);
+    if (!mapFile) throw std::runtime_error(std::string("Can not open ") + argv[2] + ".");
+    KnightMap map;
+    mapFile >> map;
+
+    std::string line, cell;
+    while (std::getline(std::cin, line)) {
+      std::stringstream iss(line);
+      Vec2 pos;
+      try {
+        if (!(iss >> pos.x_ >> pos.y_ >> cell) || cell.size() != 1 || !map.isInside(pos)) {
+          throw std::runtime_error("Bad edit.");
+        }
+        map.setCellType(pos, KnightMap::parseCell(cell[0]));
+      } catch (const std::runtime_error&) {
+        std::cout << "BAD_REQUEST\n";
+        continue;
       }
+      KnightMap fresh(map);
+      fresh.indexComponents();
+      std::cout << (map.hasSameComponents(fresh) ? "SAME " : "DIFFERENT ") << map.getLabelCount() << '\n';
     }
+    return 0;
   }
 
-  // No path.
-  dist = board.getDist(dest);
-  if (dist < 0) return false;
+  // l4 --batch <map file> [threads]
+  if (argc >= 3 && std::string(argv[1]) == "--batch") {
+    std::ifstream mapFile(argv[2]);
+    if (!mapFile) throw std::runtime_error(std::string("Can not open ") + argv[2] + ".");
+    KnightMap map;
+    {
+      STATS_PHASE(PARSE);
+      mapFile >> map;
+    }
 
-  Vec2 cur = dest;
-  while (board.hasPrev(cur)) {
-    const Vec2 prev(board.getPrev(cur));
-    const Vec2 move = cur - prev;
-    moves.push_back(move);
-    cur = prev;
+    std::ios::sync_with_stdio(false);
+    const int numThreads = argc >= 4 ? std::atoi(argv[3]) : std::thread::hardware_concurrency();
+    runBatch(std::cin, std::cout, numThreads, [&map, timeout]() { return makeWorker(map, timeout); });
+    return 0;
   }
-  std::reverse(moves.begin(), moves.end());
-  return true;
-}
 
-struct MoveResult {
-  bool found_;
-  int dist_;
-  std::vector<Vec2> moves_;
-  MoveResult(): found_(false), dist_(-1), moves_(0) {}
-};
+  // l4 --serve <socket> <map file>...
+  if (argc >= 4 && std::string(argv[1]) == "--serve") {
+    std::vector<KnightMap> maps(argc - 3);
+    for (int i = 3; i < argc; ++i) {
+      std::ifstream mapFile(argv[i]);
+      if (!mapFile) throw std::runtime_error(std::string("Can not open ") + argv[i] + ".");
+      mapFile >> maps[i - 3];
+    }
+    serve(argv[2], [&maps, timeout]() { return makeHandler(maps, timeout); });
+    return 0;
+  }
 
-MoveResult findMoves(const KnightMap& map, const Vec2& start, const Vec2& end) {
-  MoveResult result;
-  StateBoard board(map.getDepth(), map.getWidth());
-  result.found_ = dijkstra(start, end, map, board, result.moves_, result.dist_);
-  return result;
-}
+  // l4 [--binary]
+  const bool binary = argc >= 2 && std::string(argv[1]) == "--binary";
 
-int main(int argc, char* argv[]) {
   // Read start, end position
   Vec2 start, end;
-  std::string line;
-  std::getline(std::cin, line);
-  std::stringstream iss(line);
-  iss >> start.x_ >> start.y_;
-  iss >> end.x_ >> end.y_;
-
-  // Read the map
   KnightMap map;
-  std::cin >> map;
+  {
+    STATS_PHASE(PARSE);
+    std::string line;
+    std::getline(std::cin, line);
+    std::stringstream iss(line);
+    iss >> start.x_ >> start.y_;
+    iss >> end.x_ >> end.y_;
+
+    // Read the map
+    std::cin >> map;
+  }
   if (!map.isInside(start) || !map.isInside(end)) {
     throw std::runtime_error("start or end out of map.");
   }
@@ -444,15 +1110,22 @@ int main(int argc, char* argv[]) {
   // std::cout << "map.getWidth(): " << map.getWidth() << "\n";
   // std::cout << "map.getDepth(): " << map.getDepth() << "\n\n";
 
-  MoveResult result = findMoves(map, start, end);
-  if (!result.found_) {
-    std::cout << "NO_PATH\n";
-  } else {
-    std::cout << result.dist_ << "\n";
-    std::cout << std::showpos;
-    for (auto move : result.moves_) {
-      std::cout << move.x_ << "\t" << move.y_ << "\n";
-    }
-
+  std::unique_ptr<CanonicalSolver> solver;
+  {
+    STATS_PHASE(BUILD);
+    solver.reset(new CanonicalSolver(map));
   }
+  SearchControl control;
+  control.setTimeout(timeout);
+  MoveResult result;
+  try {
+    result = solver->findMoves(start, end, control);
+  } catch (const SearchCancelled&) {
+    std::cout << "TIMEOUT\n";
+    return 3;
+  }
+
+  STATS_PHASE(PRINT);
+  FdWriter out(STDOUT_FILENO);
+  writeResult(result.found_, true, result.dist_, result.moves_, binary, out);
 }
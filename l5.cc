@@ -1,90 +1,16 @@
 #include <vector>
+#include <algorithm>
+#include <map>
+#include <tuple>
 #include <sstream>
 #include <iostream>
 #include <ios>
 
-// Simple vector class representing position on the board as well as
-// movement.
-struct Vec2 {
-  int x_, y_;
-  Vec2(int x, int y): x_(x), y_(y) {}
-  Vec2(): x_(0), y_(0) {}
-};
-
-// Comparator, used in std::find
-bool operator==(const Vec2& v1, const Vec2& v2) {
-  return v1.x_ == v2.x_ && v1.y_ == v2.y_;
-}
-
-// Sum
-Vec2 operator+(const Vec2& v1, const Vec2& v2) {
-  return Vec2(v1.x_ + v2.x_, v1.y_ + v2.y_);
-}
-
-// Substract
-Vec2 operator-(const Vec2& v1, const Vec2& v2) {
-  return Vec2(v1.x_ - v2.x_, v1.y_ - v2.y_);
-}
-
-// A class encapsulate the rule the a knight must follow. At any
-// point, a knight might have 8 potential moves.
-class ChessRule {
- public:
-  // Since the set of valid moves is very small (only 8 elements), use
-  // std::vector is efficient even for linear search.
-  static const std::vector<Vec2> validKnightMoves;
-
-  static bool isValidKnightMove(const Vec2& move) {
-    return std::find(validKnightMoves.begin(), validKnightMoves.end(), move) !=
-        validKnightMoves.end();
-  }
-}; // class ChessRule
-
-const std::vector<Vec2> ChessRule::validKnightMoves = {
-  { +1, +2 },
-  { +2, +1 },
-  { +2, -1 },
-  { +1, -2 },
-  { -1, +2 },
-  { -2, +1 },
-  { -2, -1 },
-  { -1, -2 }
-};
-
-// A helper class to store the vertex states of depth first search.
-class Board {
- public:
-  // Coordinate system:
-  // ---> x(width)
-  // |
-  // V
-  // y(depth)
-  Board(int depth, int width): depth_(depth), width_(width) {
-    if (depth_ <= 0) throw std::runtime_error("Board.depth_ must > 0");
-    if (width_ <= 0) throw std::runtime_error("Board.width_ must > 0");
-    onCurrentPath_.resize(depth_ * width_, false);
-  }
-
-  // Return whether the vertex is visited or not.
-  inline bool isOnCurrentPath(const Vec2& pos) const {
-    return onCurrentPath_[pos.y_ * width_ + pos.x_];
-  }
-
-  // Set whether the vertex is visited or not.
-  inline void setOnCurrentPath(const Vec2& pos, bool visited) {
-    onCurrentPath_[pos.y_ * width_ + pos.x_] = visited;
-  }
-
-  inline bool isInside(const Vec2& pos) const {
-    return pos.x_ >= 0 && pos.x_ < width_ && pos.y_ >= 0 && pos.y_ < depth_;
-  }
-
- private:
-  int depth_, width_;
-  std::vector<bool> onCurrentPath_;
-
-}; // class Board
-
+#include "knight.h"
+#include "knight_map.h"
+#include "stats.h"
+#include "output.h"
+#include "control.h"
 
 // Main logic of level-2
 struct MoveResult {
@@ -93,11 +19,15 @@ struct MoveResult {
   MoveResult(): found_(false), moves_(0) {}
 };
 
-// Depth first search for longest path from u to dest.  Board stores
-// the visited state, movesSofar store the sequence of moves from
-// start to current vertex u.
-void dfs(const Vec2& u, const Vec2& dest, Board& board,
-         std::vector<Vec2>& movesSofar, MoveResult& result) {
+// Depth first search for longest path from u to dest. onCurrentPath
+// stores whether a vertex is on the current path, padding cells are
+// always on it. movesSofar store the sequence of moves from start to
+// current vertex u.
+void dfs(int u, int dest, const Board& board, std::vector<char>& onCurrentPath,
+         std::vector<Vec2>& movesSofar, MoveResult& result, SearchControl& control) {
+  control.tick();
+  STATS_COUNT(DFS_NODES);
+  STATS_MAX(MAX_FRONTIER, movesSofar.size());
   if (u == dest) {
     result.found_ = true;
     if (movesSofar.size() > result.moves_.size()) {
@@ -107,48 +37,482 @@ void dfs(const Vec2& u, const Vec2& dest, Board& board,
     return;
   }
 
-  board.setOnCurrentPath(u, true);
+  onCurrentPath[u] = true;
   // foreach neighbor v of u, if it is not visited, recursive dfs.
-  for (auto move: ChessRule::validKnightMoves) {
-    Vec2 v = u + move;
-    if (!board.isInside(v)) continue;
-
-    if (!board.isOnCurrentPath(v)) {
-      movesSofar.push_back(move);
-      dfs(v, dest, board, movesSofar, result);
+  board.forEachNeighbor(u, [&](int v, int i) {
+    STATS_COUNT(RELAXED);
+    if (!onCurrentPath[v]) {
+      movesSofar.push_back(Knight::move(i));
+      dfs(v, dest, board, onCurrentPath, movesSofar, result, control);
       movesSofar.pop_back();
     }
+  });
+  onCurrentPath[u] = false;
+}
+
+// Return true if the i-th first move is the image of a smaller first
+// move under one of the symmetries. Its subtree is then a mirror image
+// of a subtree already searched, and holds no longer path.
+bool isSymmetricFirstMove(int i, const std::vector<Symmetry>& stabilizer) {
+  for (auto s: stabilizer) {
+    if (s.applyToMoveIndex(i) < i) return true;
   }
-  board.setOnCurrentPath(u, false);
+  return false;
 }
 
-MoveResult findMoves(int depth, int width, const Vec2& start, const Vec2& end) {
+// Throws SearchCancelled if control is cancelled or its deadline
+// passes.
+MoveResult findMoves(int depth, int width, const Vec2& start, const Vec2& end,
+                     SearchControl& control) {
+  STATS_PHASE(SEARCH);
   MoveResult result;
   Board board(depth, width);
+  if (!board.isInside(start) || !board.isInside(end)) return result;
+
+  std::vector<char> onCurrentPath = board.makeCells<char>(false, true);
   std::vector<Vec2> moves;
-  dfs(start, end, board, moves, result);
+  const int s = board.posToIndex(start), t = board.posToIndex(end);
+  if (!BoardComponents(board).isConnected(s, t)) return result;
+  if (s == t) {
+    dfs(s, t, board, onCurrentPath, moves, result, control);
+    return result;
+  }
+
+  // Symmetries fixing both start and end, i.e. start and end lie on
+  // the same symmetry axis.
+  std::vector<Symmetry> stabilizer;
+  for (auto sym: Symmetry::all(depth, width)) {
+    if (!sym.isIdentity() && sym.apply(start) == start && sym.apply(end) == end) {
+      stabilizer.push_back(sym);
+    }
+  }
+
+  // Expand the root by hand to skip the symmetric first moves.
+  onCurrentPath[s] = true;
+  board.forEachNeighbor(s, [&](int v, int i) {
+    if (onCurrentPath[v]) return;
+    if (isSymmetricFirstMove(i, stabilizer)) {
+      STATS_COUNT(PRUNES);
+      return;
+    }
+
+    moves.push_back(Knight::move(i));
+    dfs(v, t, board, onCurrentPath, moves, result, control);
+    moves.pop_back();
+  });
   return result;
 }
 
+// Longest simple path on a level 4 map: the path from start to end
+// through distinct cells with the largest sum of edge weights, moving
+// by KnightMap::adj (no ROCK or BARRIER landing, no BARRIER crossing,
+// teleport hops). A branch and bound depth first search:
+// - An edge weighs the weight of the cell it lands on, and the rest of
+//   the path enters each of its cells once, so its cost is at most the
+//   sum of the weights of the cells it may use, see bound. The branch
+//   is cut if end can not be reached, or if the bound can not beat the
+//   best path found.
+// - Heavier moves are tried first, then the moves to cells with fewer
+//   onward moves (Warnsdorff's rule), so a costly path is found early
+//   and the bound cuts more. Only the moves to cells of the region of
+//   bound, which may still reach end, are tried.
+// The search is anytime: stopped by its node budget or by control, it
+// returns the best path found so far.
+class LongestPathSearch {
+ public:
+  struct Result {
+    bool found_;
+    // The search ended, the path is a longest one.
+    bool complete_;
+    int cost_;
+    std::vector<Vec2> moves_;
+    Result(): found_(false), complete_(true), cost_(0) {}
+  };
+
+  LongestPathSearch(const KnightMap& map):
+      map_(map), onPath_(map.getBoard().size(), false), local_(map.getBoard().size()),
+      region_(map.getBoard(), false), towards_(map.getBoard(), false) {}
+
+  // Search from start to end, both inside the map, expanding at most
+  // budget nodes (no limit if 0).
+  Result find(const Vec2& start, const Vec2& end, uint64_t budget, SearchControl& control) {
+    STATS_PHASE(SEARCH);
+    result_ = Result();
+    const int s = map_.posToIndex(start);
+    t_ = map_.posToIndex(end);
+    if (!map_.mayReach(s, t_)) return result_;
+
+    budget_ = budget;
+    nodes_ = 0;
+    control_ = &control;
+    path_.clear();
+    try {
+      dfs(s, 0);
+    } catch (const SearchCancelled&) {
+      std::fill(onPath_.begin(), onPath_.end(), false);
+      result_.complete_ = false;
+    }
+    return result_;
+  }
+
+ private:
+  // A move of the current path's last cell: the weight of the edge, the
+  // number of moves onward from the cell it lands on, and the cell.
+  struct Move {
+    int weight_, onward_, v_;
+  };
+
+  // A vertex of the depth first search of bound, by local number, and
+  // the index of its next neighbor.
+  struct Frame {
+    int v_, next_;
+  };
+
+  const KnightMap& map_;
+  std::vector<char> onPath_;
+  std::vector<int> path_;
+  // The moves of each cell of the path, by depth.
+  std::vector<std::vector<Move> > moves_;
+  int t_;
+  uint64_t budget_, nodes_;
+  SearchControl* control_;
+  Result result_;
+
+  // State of bound: the cells the rest of the path may use by local
+  // number, their neighbors (first_[i] to first_[i + 1]) and the
+  // numbers of the block search.
+  std::vector<int> local_, cells_, first_, neighbors_, order_, low_, blockStack_, stack_;
+  std::vector<char> hasEnd_, usable_;
+  std::vector<Frame> frames_;
+  StampedSet region_, towards_;
+
+  void dfs(int u, int cost) {
+    control_->tick();
+    STATS_COUNT(DFS_NODES);
+    if (budget_ != 0 && ++nodes_ > budget_) throw SearchCancelled();
+    path_.push_back(u);
+    STATS_MAX(MAX_FRONTIER, path_.size());
+    if (u == t_) {
+      if (!result_.found_ || cost > result_.cost_) record(cost);
+      path_.pop_back();
+      return;
+    }
+
+    const int rest = bound(u);
+    if (rest < 0 || (result_.found_ && cost + rest <= result_.cost_)) {
+      STATS_COUNT(PRUNES);
+      path_.pop_back();
+      return;
+    }
+
+    const size_t depth = path_.size() - 1;
+    if (moves_.size() <= depth) moves_.resize(depth + 1);
+    std::vector<Move>& moves = moves_[depth];
+    moves.clear();
+    map_.adj(u, [&](int v) {
+      STATS_COUNT(RELAXED);
+      if (onPath_[v] || !region_.contains(v)) return;
+      int onward = 0;
+      map_.adj(v, [&](int w) { onward += w != u && region_.contains(w); });
+      moves.push_back(Move { map_.edgeWeight(u, v), onward, v });
+    });
+    std::sort(moves.begin(), moves.end(), [](const Move& a, const Move& b) {
+      return a.weight_ != b.weight_ ? a.weight_ > b.weight_ : a.onward_ < b.onward_;
+    });
+
+    onPath_[u] = true;
+    // Indexed, moves_ may grow in the recursion.
+    for (size_t i = 0; i < moves_[depth].size(); ++i) {
+      const Move move = moves_[depth][i];
+      dfs(move.v_, cost + move.weight_);
+    }
+    onPath_[u] = false;
+    path_.pop_back();
+  }
+
+  // Return a bound of the cost of the rest of a path from u to end, -1
+  // if there is none:
+  // - The region: the cells reachable from u through cells that reach
+  //   end, none of them on the path.
+  // - The rest of the path is a simple path of the region, even with
+  //   its edges taken both ways, so it stays in the biconnected blocks
+  //   between u and end: a block hanging off another could only be
+  //   left through the cell it was entered by.
+  // - A knight move changes the color of the cell, so without teleport
+  //   hops the path alternates colors: it has as many cells of each
+  //   color, or one more of the color of end if it is not u's. Each hop
+  //   between the usable teleports loosens this by one. The bound is
+  //   the sum of the heaviest such cells.
+  int bound(int u) {
+    towards_.reset();
+    towards_.insert(t_);
+    stack_.assign(1, t_);
+    while (!stack_.empty()) {
+      const int w = stack_.back();
+      stack_.pop_back();
+      map_.radj(w, [&](int v) {
+        if (v == u || onPath_[v] || towards_.contains(v)) return;
+        towards_.insert(v);
+        stack_.push_back(v);
+      });
+    }
+
+    region_.reset();
+    region_.insert(u);
+    cells_.assign(1, u);
+    local_[u] = 0;
+    for (size_t i = 0; i < cells_.size(); ++i) {
+      map_.adj(cells_[i], [&](int v) {
+        if (region_.contains(v) || !towards_.contains(v)) return;
+        region_.insert(v);
+        local_[v] = cells_.size();
+        cells_.push_back(v);
+      });
+    }
+    if (!region_.contains(t_)) return -1;
+
+    const int n = cells_.size();
+    first_.resize(n + 1);
+    neighbors_.clear();
+    for (int i = 0; i < n; ++i) {
+      first_[i] = neighbors_.size();
+      const auto add = [&](int v) {
+        if (region_.contains(v)) neighbors_.push_back(local_[v]);
+      };
+      map_.adj(cells_[i], add);
+      map_.radj(cells_[i], add);
+    }
+    first_[n] = neighbors_.size();
+    findBlocks(local_[t_]);
+
+    // Numbers of usable cells but u of each color and weight, color 1
+    // is u's.
+    int counts[2][KnightMap::MAX_EDGE_WEIGHT + 1] = {};
+    int teleports = map_.edgeWeight(u, u) == 0 ? 1 : 0;
+    const int color = parity(u);
+    for (int i = 1; i < n; ++i) {
+      if (!usable_[i]) continue;
+      const int weight = map_.edgeWeight(u, cells_[i]);
+      ++counts[parity(cells_[i]) == color][weight];
+      if (weight == 0) ++teleports;
+    }
+
+    // With h teleport hops, cells of the color of u's moves (0) may
+    // outnumber the others by 1 + h, and be outnumbered by h.
+    int total[2] = { 0, 0 };
+    for (int c = 0; c < 2; ++c) {
+      for (auto count : counts[c]) total[c] += count;
+    }
+    int limit[2];
+    if (teleports < 2) {
+      limit[1] = std::min(total[1], parity(t_) == color ? total[0] : total[0] - 1);
+      limit[0] = parity(t_) == color ? limit[1] : limit[1] + 1;
+    } else {
+      const int hops = teleports - 1;
+      limit[0] = std::min(total[0], total[1] + 1 + hops);
+      limit[1] = std::min(total[1], total[0] + hops);
+    }
+
+    int sum = 0;
+    for (int c = 0; c < 2; ++c) {
+      for (int weight = KnightMap::MAX_EDGE_WEIGHT; weight > 0 && limit[c] > 0; --weight) {
+        const int k = std::min(counts[c][weight], limit[c]);
+        sum += k * weight;
+        limit[c] -= k;
+      }
+    }
+    return sum;
+  }
+
+  // Set usable_ to the cells of the blocks between cell 0 and cell end
+  // of the region, by Tarjan's algorithm: when the search leaves child
+  // c of v with low(c) >= order(v), the cells above c on the stack and
+  // v form a block, which is between them if end is below c.
+  void findBlocks(int end) {
+    const int n = cells_.size();
+    order_.assign(n, -1);
+    low_.resize(n);
+    hasEnd_.assign(n, false);
+    usable_.assign(n, false);
+    blockStack_.clear();
+    frames_.clear();
+    int visited = 0;
+    const auto enter = [&](int v) {
+      order_[v] = low_[v] = visited++;
+      hasEnd_[v] = v == end;
+      blockStack_.push_back(v);
+      frames_.push_back(Frame { v, first_[v] });
+    };
+
+    enter(0);
+    while (!frames_.empty()) {
+      Frame& frame = frames_.back();
+      const int v = frame.v_;
+      if (frame.next_ < first_[v + 1]) {
+        const int w = neighbors_[frame.next_++];
+        if (order_[w] < 0) {
+          enter(w);
+        } else {
+          low_[v] = std::min(low_[v], order_[w]);
+        }
+        continue;
+      }
+
+      frames_.pop_back();
+      if (frames_.empty()) break;
+      const int parent = frames_.back().v_;
+      low_[parent] = std::min(low_[parent], low_[v]);
+      hasEnd_[parent] = hasEnd_[parent] || hasEnd_[v];
+      if (low_[v] < order_[parent]) continue;
+      for (int w = -1; w != v;) {
+        w = blockStack_.back();
+        blockStack_.pop_back();
+        if (hasEnd_[v]) usable_[w] = true;
+      }
+      if (hasEnd_[v]) usable_[parent] = true;
+    }
+  }
+
+  inline int parity(int u) const {
+    const Vec2 pos = map_.indexToPos(u);
+    return (pos.x_ + pos.y_) & 1;
+  }
+
+  void record(int cost) {
+    result_.found_ = true;
+    result_.cost_ = cost;
+    result_.moves_.clear();
+    for (size_t i = 1; i < path_.size(); ++i) {
+      result_.moves_.push_back(map_.indexToPos(path_[i]) - map_.indexToPos(path_[i - 1]));
+    }
+  }
+
+}; // class LongestPathSearch
+
+// Solves queries in a canonical orientation of the board and caches
+// the results, so a mirrored or rotated query is answered by mapping
+// the cached moves back instead of searching again.
+class CanonicalSolver {
+ public:
+  // A cancelled search caches nothing.
+  MoveResult findMoves(int depth, int width, const Vec2& start, const Vec2& end,
+                       SearchControl& control) {
+    // Pick the symmetry that maps (start, end) to the smallest pair.
+    std::vector<Symmetry> symmetries = Symmetry::all(depth, width);
+    Symmetry canonical = symmetries[0];
+    Key key = makeKey(depth, width, start, end);
+    for (auto s: symmetries) {
+      Key k = makeKey(depth, width, s.apply(start), s.apply(end));
+      if (k < key) {
+        key = k;
+        canonical = s;
+      }
+    }
+
+    std::map<Key, MoveResult>::const_iterator it = cache_.find(key);
+    if (it == cache_.end()) {
+      const MoveResult solved =
+          ::findMoves(depth, width, canonical.apply(start), canonical.apply(end), control);
+      it = cache_.insert(std::make_pair(key, solved)).first;
+    }
+
+    // Map the canonical moves back to the original orientation.
+    MoveResult result = it->second;
+    const Symmetry back = canonical.inverse();
+    for (auto& move: result.moves_) {
+      move = Knight::move(back.applyToMoveIndex(Knight::moveIndex(move)));
+    }
+    return result;
+  }
+
+ private:
+  typedef std::tuple<int, int, int, int, int, int> Key;
+  std::map<Key, MoveResult> cache_;
+
+  static Key makeKey(int depth, int width, const Vec2& start, const Vec2& end) {
+    return Key(depth, width, start.y_, start.x_, end.y_, end.x_);
+  }
+
+}; // class CanonicalSolver
+
 int main(int argc, char* argv[]) {
-  std::string line;
-  std::getline(std::cin, line);
-  std::stringstream iss(line);
+  // l5 [--deadline <ms>] [--progress] [--binary | --map [nodes]]
+  const int timeout = parseDeadline(argc, argv);
+  const bool progress = argc >= 2 && std::string(argv[1]) == "--progress";
+  if (progress) {
+    argv[1] = argv[0];
+    ++argv;
+    --argc;
+  }
+
+  // l5 --map [nodes], reads a level 4 query and map
+  if (argc >= 2 && std::string(argv[1]) == "--map") {
+    Vec2 start, end;
+    KnightMap map;
+    {
+      STATS_PHASE(PARSE);
+      std::string line;
+      std::getline(std::cin, line);
+      std::stringstream iss(line);
+      iss >> start.x_ >> start.y_ >> end.x_ >> end.y_;
+      std::cin >> map;
+    }
+    if (!map.isInside(start) || !map.isInside(end)) {
+      throw std::runtime_error("start or end out of map.");
+    }
+
+    LongestPathSearch search(map);
+    SearchControl control;
+    control.setTimeout(timeout);
+    if (progress) control.setProgress([](uint64_t steps) { std::cerr << steps << " nodes\n"; });
+    const LongestPathSearch::Result result =
+        search.find(start, end, argc >= 3 ? std::strtoull(argv[2], nullptr, 10) : 0, control);
+
+    // A search cut short prints the best path found, or TIMEOUT.
+    STATS_PHASE(PRINT);
+    if (!result.complete_ && !result.found_) {
+      std::cout << "TIMEOUT\n";
+      return 3;
+    }
+    FdWriter out(STDOUT_FILENO);
+    writeResult(result.found_, true, result.cost_, result.moves_, false, out);
+    return result.complete_ ? 0 : 3;
+  }
+
+  const bool binary = argc >= 2 && std::string(argv[1]) == "--binary";
   int depth, width;
   Vec2 start, end;
-  bool verbose;
-  iss >> depth >> width;
-  iss >> start.x_ >> start.y_;
-  iss >> end.x_ >> end.y_;
-
-  MoveResult result = findMoves(depth, width, start, end);
+  {
+    STATS_PHASE(PARSE);
+    std::string line;
+    std::getline(std::cin, line);
+    std::stringstream iss(line);
+    iss >> depth >> width;
+    iss >> start.x_ >> start.y_;
+    iss >> end.x_ >> end.y_;
+  }
 
-  if (!result.found_) {
-    std::cout << "NULL\n";
-  } else {
-    std::cout << std::showpos;
-    for (auto move : result.moves_) {
-      std::cout << move.x_ << "\t" << move.y_ << "\n";
+  // Search on an executor thread, as an embedding service would, so
+  // the query can be waited for with a deadline and report progress.
+  CanonicalSolver solver;
+  MoveResult result;
+  {
+    Executor executor(1);
+    Query<MoveResult> query = submit<MoveResult>(
+        executor,
+        [&](SearchControl& control) { return solver.findMoves(depth, width, start, end, control); },
+        timeout,
+        progress ? [](uint64_t steps) { std::cerr << steps << " nodes\n"; }
+                 : SearchControl::Progress());
+    try {
+      result = query.get();
+    } catch (const SearchCancelled&) {
+      std::cout << "TIMEOUT\n";
+      return 3;
     }
   }
+
+  STATS_PHASE(PRINT);
+  FdWriter out(STDOUT_FILENO);
+  writeResult(result.found_, false, 0, result.moves_, binary, out);
 }
@@ -0,0 +1,402 @@
+// Landmarks of a level 4 map for goal directed searches (ALT: A*,
+// landmarks and the triangle inequality).
+#ifndef LANDMARKS_H
+#define LANDMARKS_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+#include "knight.h"
+#include "knight_map.h"
+
+// The exact distances from and to a few landmark cells of a map, 16
+// bits per distance and landmark, stored cell by cell so the distances
+// of a cell to every landmark are adjacent. By the triangle inequality,
+// for a landmark L,
+//
+//   d(v, t) >= d(L, t) - d(L, v)   and   d(v, t) >= d(v, L) - d(t, L),
+//
+// and the largest of these bounds is an admissible A* heuristic. It
+// also tells that v can not reach t when L reaches v but not t, or t
+// reaches L but v does not.
+class Landmarks {
+ public:
+  // Distances that do not fit, and no path.
+  static const uint16_t FAR = 0xfffe, INF = 0xffff;
+
+  Landmarks(): requested_(0), count_(0) {}
+
+  // Pick count landmarks on map, far apart, and compute their
+  // distances. The first is the cell farthest from the open cell nearest
+  // the center, each next one the cell farthest from the ones already
+  // picked. Fewer if the map has fewer cells far enough apart.
+  void build(const KnightMap& map, int count) {
+    const Board& board = map.getBoard();
+    requested_ = count;
+    count_ = 0;
+    cells_.clear();
+    from_.clear();
+    to_.clear();
+    size_ = board.size();
+    if (count <= 0) return;
+
+    int seed = -1;
+    for (int r = 0; seed < 0 && r < std::max(map.getDepth(), map.getWidth()); ++r) {
+      for (int y = map.getDepth() / 2 - r; seed < 0 && y <= map.getDepth() / 2 + r; ++y) {
+        for (int x = map.getWidth() / 2 - r; seed < 0 && x <= map.getWidth() / 2 + r; ++x) {
+          if (map.isInside(Vec2(x, y)) && isOpen(map, map.posToIndex(Vec2(x, y)))) {
+            seed = map.posToIndex(Vec2(x, y));
+          }
+        }
+      }
+    }
+    if (seed < 0) return;
+
+    // Smallest distance from the landmarks picked, over the cells the
+    // first one reaches.
+    std::vector<int> nearest;
+    dijkstra(map, seed, false, nearest);
+    for (int l = 0; l < count; ++l) {
+      int farthest = -1;
+      for (int v = 0; v < size_; ++v) {
+        if (nearest[v] >= 0 && isOpen(map, v) && (farthest < 0 || nearest[v] > nearest[farthest])) {
+          farthest = v;
+        }
+      }
+      if (farthest < 0 || (l > 0 && nearest[farthest] == 0)) break;
+
+      cells_.push_back(farthest);
+      std::vector<int> dist;
+      dijkstra(map, farthest, false, dist);
+      for (int v = 0; v < size_; ++v) {
+        if (l == 0) {
+          nearest[v] = dist[v];
+        } else if (nearest[v] >= 0 && dist[v] >= 0) {
+          nearest[v] = std::min(nearest[v], dist[v]);
+        }
+      }
+    }
+
+    count_ = cells_.size();
+    from_.assign(static_cast<size_t>(size_) * count_, static_cast<uint16_t>(INF));
+    to_ = from_;
+    for (int l = 0; l < count_; ++l) compute(map, l, false), compute(map, l, true);
+  }
+
+  inline int getCount() const { return count_; }
+
+  // The landmark cells, as flat indices.
+  inline const std::vector<int>& getCells() const { return cells_; }
+
+  // Lower bounds of the distances to a target cell.
+  class Bound {
+   public:
+    // Return a lower bound of the distance from v to the target, -1 if
+    // v can not reach it.
+    inline int operator()(int v) const {
+      const uint16_t* from = &landmarks_.from_[static_cast<size_t>(v) * count_];
+      const uint16_t* to = &landmarks_.to_[static_cast<size_t>(v) * count_];
+      int bound = 0;
+      for (int l = 0; l < count_; ++l) {
+        if (targetFrom_[l] < FAR) {
+          if (from[l] < FAR) bound = std::max(bound, targetFrom_[l] - from[l]);
+        } else if (targetFrom_[l] == INF && from[l] != INF) {
+          return -1;
+        }
+        if (targetTo_[l] < FAR) {
+          if (to[l] < FAR) {
+            bound = std::max(bound, to[l] - targetTo_[l]);
+          } else if (to[l] == INF) {
+            return -1;
+          }
+        }
+      }
+      return bound;
+    }
+
+   private:
+    friend class Landmarks;
+    const Landmarks& landmarks_;
+    int count_;
+    std::vector<int> targetFrom_, targetTo_;
+
+    Bound(const Landmarks& landmarks, int t):
+        landmarks_(landmarks), count_(landmarks.count_),
+        targetFrom_(count_), targetTo_(count_) {
+      for (int l = 0; l < count_; ++l) {
+        targetFrom_[l] = landmarks.from_[static_cast<size_t>(t) * count_ + l];
+        targetTo_[l] = landmarks.to_[static_cast<size_t>(t) * count_ + l];
+      }
+    }
+  };
+
+  inline Bound towards(int t) const { return Bound(*this, t); }
+
+  // Set the type of the cell at pos on map, and recompute the distances
+  // the edit may change. Only the edges landing on the cell, the moves
+  // crossing it and its teleport hops change. The distances from a
+  // landmark change only if one of the old edges was on a shortest
+  // path (d(a) + w = d(b)), or one of the new ones is a shortcut
+  // (d(a) + w < d(b)), and likewise for the distances to it. Return the
+  // number of distance arrays recomputed.
+  int setCellType(KnightMap& map, const Vec2& pos, KnightMap::CellType type) {
+    std::vector<Edge> before, after;
+    const int v = map.posToIndex(pos);
+    edgesNear(map, v, before);
+    map.setCellType(pos, type);
+    edgesNear(map, v, after);
+
+    int recomputed = 0;
+    for (int l = 0; l < count_; ++l) {
+      for (int reverse = 0; reverse < 2; ++reverse) {
+        if (isAffected(l, reverse, before, after)) {
+          compute(map, l, reverse);
+          ++recomputed;
+        }
+      }
+    }
+    return recomputed;
+  }
+
+  // Write the landmarks of map to path. The file is only a cache: if it
+  // can not be written, report it on stderr, remove what was written and
+  // return false.
+  bool save(const KnightMap& map, const std::string& path) const {
+    std::ofstream file(path.c_str(), std::ios::binary);
+    if (!file) {
+      std::cerr << "Can not write " << path << ", landmarks not saved.\n";
+      return false;
+    }
+    const uint64_t header[] = {
+      MAGIC, static_cast<uint64_t>(map.getDepth()), static_cast<uint64_t>(map.getWidth()),
+      fingerprint(map), static_cast<uint64_t>(requested_), static_cast<uint64_t>(count_)
+    };
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    std::vector<int32_t> positions;
+    for (auto cell : cells_) {
+      positions.push_back(map.indexToPos(cell).x_);
+      positions.push_back(map.indexToPos(cell).y_);
+    }
+    file.write(reinterpret_cast<const char*>(positions.data()), positions.size() * sizeof(int32_t));
+
+    // Cells in row major order, whatever the CellLayout.
+    for (const std::vector<uint16_t>* dist : { &from_, &to_ }) {
+      for (int y = 0; y < map.getDepth(); ++y) {
+        for (int x = 0; x < map.getWidth(); ++x) {
+          const size_t v = map.posToIndex(Vec2(x, y));
+          file.write(reinterpret_cast<const char*>(&(*dist)[v * count_]), count_ * sizeof(uint16_t));
+        }
+      }
+    }
+    file.close();
+    if (!file) {
+      std::cerr << "Can not write " << path << ", landmarks not saved.\n";
+      std::remove(path.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  // Read the landmarks of map from path, built for count landmarks.
+  // Return false, leaving the landmarks unchanged, if there is no such
+  // file, it was saved for another map or landmark count, or any part
+  // of it is bad: a landmark count that does
+  // not match the file size, a landmark out of the map, or a truncated
+  // or longer file. The caller builds the landmarks again.
+  bool load(const KnightMap& map, const std::string& path, int count) {
+    std::ifstream file(path.c_str(), std::ios::binary | std::ios::ate);
+    if (!file) return false;
+    const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+    uint64_t header[6];
+    if (!file.read(reinterpret_cast<char*>(header), sizeof(header))) return false;
+    if (header[0] != MAGIC || header[1] != static_cast<uint64_t>(map.getDepth()) ||
+        header[2] != static_cast<uint64_t>(map.getWidth()) || header[3] != fingerprint(map) ||
+        header[4] != static_cast<uint64_t>(count)) {
+      return false;
+    }
+
+    // The size is known from the header, check it before allocating.
+    const uint64_t cellCount = static_cast<uint64_t>(map.getDepth()) * map.getWidth();
+    const uint64_t built = header[5];
+    if (built > static_cast<uint64_t>(count) || built > cellCount ||
+        fileSize != sizeof(header) + built * (2 * sizeof(int32_t) + 2 * cellCount * sizeof(uint16_t))) {
+      return false;
+    }
+
+    std::vector<int32_t> positions(2 * built);
+    if (!file.read(reinterpret_cast<char*>(positions.data()), positions.size() * sizeof(int32_t))) return false;
+    std::vector<int> cells;
+    for (size_t l = 0; l < built; ++l) {
+      const Vec2 pos(positions[2 * l], positions[2 * l + 1]);
+      if (!map.isInside(pos)) return false;
+      cells.push_back(map.posToIndex(pos));
+    }
+
+    const int size = map.getBoard().size();
+    std::vector<uint16_t> from(static_cast<size_t>(size) * built, static_cast<uint16_t>(INF));
+    std::vector<uint16_t> to = from;
+    for (std::vector<uint16_t>* dist : { &from, &to }) {
+      for (int y = 0; y < map.getDepth(); ++y) {
+        for (int x = 0; x < map.getWidth(); ++x) {
+          const size_t v = map.posToIndex(Vec2(x, y));
+          file.read(reinterpret_cast<char*>(&(*dist)[v * built]), built * sizeof(uint16_t));
+        }
+      }
+    }
+    if (!file) return false;
+
+    requested_ = count;
+    count_ = static_cast<int>(built);
+    size_ = size;
+    cells_.swap(cells);
+    from_.swap(from);
+    to_.swap(to);
+    return true;
+  }
+
+ private:
+  // "KNLM", version 2: the header holds the landmark count asked for
+  // and the count built.
+  static const uint64_t MAGIC = 0x020000004d4c4e4bull;
+
+  struct Edge {
+    int from_, to_, weight_;
+  };
+
+  int requested_, count_, size_;
+  std::vector<int> cells_;
+  // Distance from (to) landmark l to (from) cell v at v * count_ + l.
+  std::vector<uint16_t> from_, to_;
+
+  static inline bool isOpen(const KnightMap& map, int v) {
+    const KnightMap::CellType type = map.getCellType(v);
+    return type != KnightMap::ROCK && type != KnightMap::BARRIER;
+  }
+
+  // Dijkstra's algorithm from source, on the reversed graph if reverse
+  // is set. dist is -1 for the cells not reached.
+  static void dijkstra(const KnightMap& map, int source, bool reverse, std::vector<int>& dist) {
+    typedef std::pair<int, int> Entry;
+    const std::greater<Entry> later;
+    std::vector<Entry> q;
+    dist.assign(map.getBoard().size(), -1);
+    dist[source] = 0;
+    q.push_back(Entry(0, source));
+
+    while (!q.empty()) {
+      std::pop_heap(q.begin(), q.end(), later);
+      const int uDist = q.back().first, u = q.back().second;
+      q.pop_back();
+      if (uDist > dist[u]) continue;
+
+      // Backwards, a ROCK or BARRIER cell can start a path (a query
+      // may start there) but no edge lands on it.
+      if (reverse) {
+        if (u != source && !isOpen(map, u)) continue;
+        map.radj(u, [&](int v) {
+          const int newDist = uDist + map.edgeWeight(v, u);
+          if (dist[v] == -1 || newDist < dist[v]) {
+            dist[v] = newDist;
+            q.push_back(Entry(newDist, v));
+            std::push_heap(q.begin(), q.end(), later);
+          }
+        });
+      } else {
+        map.adj(u, [&](int v) {
+          const int newDist = uDist + map.edgeWeight(u, v);
+          if (dist[v] == -1 || newDist < dist[v]) {
+            dist[v] = newDist;
+            q.push_back(Entry(newDist, v));
+            std::push_heap(q.begin(), q.end(), later);
+          }
+        });
+      }
+    }
+  }
+
+  // Compute the distances from (to, if reverse) landmark l.
+  void compute(const KnightMap& map, int l, bool reverse) {
+    std::vector<int> dist;
+    dijkstra(map, cells_[l], reverse, dist);
+    std::vector<uint16_t>& stored = reverse ? to_ : from_;
+    const Board& board = map.getBoard();
+    for (int v = 0; v < size_; ++v) {
+      uint16_t& d = stored[static_cast<size_t>(v) * count_ + l];
+      if (dist[v] < 0 || board.isPadding(v)) {
+        d = INF;
+      } else {
+        d = std::min<int>(dist[v], FAR);
+      }
+    }
+  }
+
+  // The edges of map that an edit of cell v may add, remove or
+  // reweight: the moves landing on v, the moves whose long leg crosses
+  // v and the teleport hops from and to v.
+  static void edgesNear(const KnightMap& map, int v, std::vector<Edge>& edges) {
+    const Board& board = map.getBoard();
+    auto add = [&](int a, const Vec2& move) {
+      if (board.isPadding(a)) return;
+      const int b = map.moveTarget(a, move);
+      if (b >= 0) edges.push_back(Edge { a, b, map.edgeWeight(a, b) });
+    };
+    for (int i = 0; i < Knight::N; ++i) {
+      add(board.shift(v, -Knight::dx(i), -Knight::dy(i)), Knight::move(i));
+      add(board.shift(v, -(Knight::dx(i) / 2), -(Knight::dy(i) / 2)), Knight::move(i));
+    }
+    if (map.getCellType(v) == KnightMap::TELEPORT) {
+      for (auto t : map.getTeleports()) {
+        if (t == v) continue;
+        edges.push_back(Edge { v, t, map.edgeWeight(v, t) });
+        edges.push_back(Edge { t, v, map.edgeWeight(t, v) });
+      }
+    }
+  }
+
+  // Return true if the distances from (to, if reverse) landmark l may
+  // change when the edges before are replaced by the edges after.
+  bool isAffected(int l, bool reverse, const std::vector<Edge>& before,
+                  const std::vector<Edge>& after) const {
+    const std::vector<uint16_t>& stored = reverse ? to_ : from_;
+    // The distance at the tail (head, if reverse) of an edge, then at
+    // its head (tail).
+    auto dist = [&](const Edge& e, bool head) {
+      return static_cast<int>(stored[static_cast<size_t>(head != reverse ? e.to_ : e.from_) * count_ + l]);
+    };
+    for (auto& e : before) {
+      const int a = dist(e, false), b = dist(e, true);
+      if (a == FAR || b == FAR) return true;
+      if (a != INF && a + e.weight_ == b) return true;
+    }
+    for (auto& e : after) {
+      const int a = dist(e, false), b = dist(e, true);
+      if (a == FAR || b == FAR) return true;
+      if (a != INF && (b == INF || a + e.weight_ < b)) return true;
+    }
+    return false;
+  }
+
+  // FNV-1a of the cell types, so a landmark file is not used with an
+  // edited map.
+  static uint64_t fingerprint(const KnightMap& map) {
+    uint64_t hash = 14695981039346656037ull;
+    for (int y = 0; y < map.getDepth(); ++y) {
+      for (int x = 0; x < map.getWidth(); ++x) {
+        hash = (hash ^ map.getCellType(Vec2(x, y))) * 1099511628211ull;
+      }
+    }
+    return hash;
+  }
+
+}; // class Landmarks
+
+#endif // LANDMARKS_H
@@ -0,0 +1,227 @@
+// Output of the solvers: a buffered writer formatting integers by hand,
+// and a compact binary format for move lists.
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "knight.h"
+
+// Format value in decimal at p, with a sign if showpos is set, like
+// std::showpos does. Return the end of the digits. p needs room for 12
+// characters.
+inline char* formatInt(int value, bool showpos, char* p) {
+  unsigned magnitude = value;
+  if (value < 0) {
+    *p++ = '-';
+    magnitude = 0u - magnitude;
+  } else if (showpos) {
+    *p++ = '+';
+  }
+  char digits[10];
+  int n = 0;
+  do {
+    digits[n++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude);
+  while (n) *p++ = digits[--n];
+  return p;
+}
+
+// Writes to a file descriptor through a large buffer, so printing a
+// long path takes a few write calls. Flushed on destruction. Do not mix
+// it with std::cout on the same descriptor.
+class FdWriter {
+ public:
+  explicit FdWriter(int fd, size_t capacity = 1 << 16):
+      fd_(fd), buffer_(capacity), end_(0) {}
+
+  ~FdWriter() { flush(); }
+
+  inline void putInt(int value, bool showpos) {
+    reserve(12);
+    end_ = formatInt(value, showpos, &buffer_[end_]) - &buffer_[0];
+  }
+
+  inline void put(char c) {
+    reserve(1);
+    buffer_[end_++] = c;
+  }
+
+  inline void put(const char* data, size_t n) {
+    if (n > buffer_.size()) {
+      flush();
+      writeAll(data, n);
+      return;
+    }
+    reserve(n);
+    std::memcpy(&buffer_[end_], data, n);
+    end_ += n;
+  }
+
+  inline void put(const std::string& s) { put(s.data(), s.size()); }
+
+  inline void put(const char* s) { put(s, std::strlen(s)); }
+
+  void flush() {
+    writeAll(buffer_.data(), end_);
+    end_ = 0;
+  }
+
+ private:
+  int fd_;
+  std::vector<char> buffer_;
+  size_t end_;
+
+  inline void reserve(size_t n) {
+    if (buffer_.size() - end_ < n) flush();
+  }
+
+  void writeAll(const char* data, size_t n) {
+    for (size_t done = 0; done < n;) {
+      const ssize_t written = write(fd_, data + done, n - done);
+      if (written <= 0) throw std::runtime_error("Can not write output.");
+      done += written;
+    }
+  }
+
+}; // class FdWriter
+
+// Write moves one per line, as the solvers print them.
+inline void writeMoveLines(const std::vector<Vec2>& moves, FdWriter& out) {
+  for (auto move : moves) {
+    out.putInt(move.x_, true);
+    out.put('\t');
+    out.putInt(move.y_, true);
+    out.put('\n');
+  }
+}
+
+// Binary move lists. A record is
+//
+//   "KNMV" <flags> <moves + 1> [<dist>] <runs>
+//
+// where the numbers are LEB128 varints, flags bit 0 tells whether the
+// distance is present (level 4) and moves + 1 is 0 if there is no
+// path. Each run is one byte, (length - 1) << 3 | i, standing for
+// length (1 to 31) times Knight::move(i). A byte 0xff escapes a move
+// that is not a knight move (a teleport), followed by its x and y as
+// zigzag varints.
+namespace binary_moves {
+
+const char MAGIC[4] = { 'K', 'N', 'M', 'V' };
+const int HAS_DIST = 1;
+const int MAX_RUN = 31;
+const unsigned char ESCAPE = 0xff;
+
+inline void putVarint(unsigned value, std::string& out) {
+  while (value >= 0x80) {
+    out += static_cast<char>((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  out += static_cast<char>(value);
+}
+
+inline unsigned getVarint(const char*& p, const char* end) {
+  unsigned value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (p == end) break;
+    const unsigned char byte = *p++;
+    value |= (byte & 0x7fu) << shift;
+    if (!(byte & 0x80)) return value;
+  }
+  throw std::runtime_error("Truncated varint.");
+}
+
+inline unsigned zigzag(int value) { return (static_cast<unsigned>(value) << 1) ^ (value < 0 ? ~0u : 0u); }
+
+inline int unzigzag(unsigned value) { return static_cast<int>(value >> 1) ^ -static_cast<int>(value & 1); }
+
+} // namespace binary_moves
+
+// Append the binary record of a path to out. dist is only stored if
+// withDist is set.
+inline void appendBinaryMoves(bool found, bool withDist, int dist,
+                              const std::vector<Vec2>& moves, std::string& out) {
+  using namespace binary_moves;
+  out.append(MAGIC, sizeof(MAGIC));
+  putVarint(withDist ? HAS_DIST : 0, out);
+  putVarint(found ? moves.size() + 1 : 0, out);
+  if (!found) return;
+  if (withDist) putVarint(dist, out);
+
+  for (size_t i = 0; i < moves.size();) {
+    const int index = Knight::moveIndex(moves[i]);
+    if (index < 0) {
+      out += static_cast<char>(ESCAPE);
+      putVarint(zigzag(moves[i].x_), out);
+      putVarint(zigzag(moves[i].y_), out);
+      ++i;
+      continue;
+    }
+    int length = 1;
+    while (length < MAX_RUN && i + length < moves.size() && moves[i + length] == moves[i]) {
+      ++length;
+    }
+    out += static_cast<char>(((length - 1) << 3) | index);
+    i += length;
+  }
+}
+
+// Parse the binary record at p, advancing p past it. Return false if
+// the record has no path.
+inline bool parseBinaryMoves(const char*& p, const char* end, bool& withDist, int& dist,
+                             std::vector<Vec2>& moves) {
+  using namespace binary_moves;
+  if (end - p < static_cast<long>(sizeof(MAGIC)) || std::memcmp(p, MAGIC, sizeof(MAGIC)) != 0) {
+    throw std::runtime_error("Not a binary move list.");
+  }
+  p += sizeof(MAGIC);
+  withDist = getVarint(p, end) & HAS_DIST;
+  const unsigned count = getVarint(p, end);
+  moves.clear();
+  if (count == 0) return false;
+  dist = withDist ? getVarint(p, end) : -1;
+
+  while (moves.size() < count - 1) {
+    if (p == end) throw std::runtime_error("Truncated move list.");
+    const unsigned char run = *p++;
+    if (run == ESCAPE) {
+      const int x = unzigzag(getVarint(p, end));
+      moves.push_back(Vec2(x, unzigzag(getVarint(p, end))));
+    } else if ((run >> 3) >= MAX_RUN) {
+      throw std::runtime_error("Bad run.");
+    } else {
+      moves.insert(moves.end(), (run >> 3) + 1, Knight::move(run & 7));
+    }
+  }
+  if (moves.size() != count - 1) throw std::runtime_error("Run past the end of the move list.");
+  return true;
+}
+
+// Write the result of a single query, as text or as a binary record.
+// A result with a distance (level 4) prints it first, and NO_PATH
+// instead of NULL.
+inline void writeResult(bool found, bool withDist, int dist, const std::vector<Vec2>& moves,
+                        bool binary, FdWriter& out) {
+  if (binary) {
+    std::string record;
+    appendBinaryMoves(found, withDist, dist, moves, record);
+    out.put(record);
+  } else if (!found) {
+    out.put(withDist ? "NO_PATH\n" : "NULL\n");
+  } else {
+    if (withDist) {
+      out.putInt(dist, false);
+      out.put('\n');
+    }
+    writeMoveLines(moves, out);
+  }
+}
+
+#endif // OUTPUT_H
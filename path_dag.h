@@ -0,0 +1,207 @@
+// All the shortest paths between two cells of a level 4 map (or of an
+// empty board, a map of DEFAULT cells), counted and enumerated one at a
+// time from the DAG of the shortest path distances.
+#ifndef PATH_DAG_H
+#define PATH_DAG_H
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <cstdint>
+
+#include "knight.h"
+#include "knight_map.h"
+#include "stats.h"
+#include "control.h"
+#include "output.h"
+
+// Teleport hops and moves landing on teleports cost 0, so a cheapest
+// path may go through any number of teleports and there would be no end
+// to them. Paths are therefore ordered by cost, then by number of
+// moves: the shortest paths are the cheapest paths with the fewest
+// moves, and every edge of their DAG adds a move, so it has no cycle.
+//
+// build() runs one search and counts the paths to every cell of the
+// DAG, saturating at SATURATED. next() then walks the DAG back from
+// the end, like a depth first search whose stack is the current path,
+// so the memory stays O(cells) whatever the number of paths, and as
+// every DAG vertex is reached from start the walk never backtracks
+// from a dead end: each path costs O(moves) steps.
+class ShortestPathDag {
+ public:
+  static const uint64_t SATURATED = ~uint64_t(0);
+
+  ShortestPathDag(const KnightMap& map):
+      map_(map), reached_(map.getBoard(), false), onDag_(map.getBoard(), false),
+      seen_(map.getBoard(), false),
+      key_(map.getBoard().size()), count_(map.getBoard().size()), s_(-1), t_(-1) {}
+
+  // Find the shortest paths from start to end, both inside the map.
+  // Return their number, 0 if there is none.
+  uint64_t build(const Vec2& start, const Vec2& end, SearchControl& control) {
+    s_ = map_.posToIndex(start);
+    t_ = map_.posToIndex(end);
+    stack_.clear();
+    started_ = false;
+    reached_.reset();
+    onDag_.reset();
+    if (!map_.mayReach(s_, t_) || !search(control)) {
+      s_ = t_ = -1;
+      return 0;
+    }
+
+    // The DAG vertices, found backwards from the end, then their number
+    // of paths from the start by increasing key.
+    STATS_PHASE(RECONSTRUCT);
+    std::vector<int> dag(1, t_);
+    onDag_.insert(t_);
+    for (size_t head = 0; head < dag.size(); ++head) {
+      forEachPrev(dag[head], [&](int u) {
+        if (onDag_.contains(u)) return;
+        onDag_.insert(u);
+        dag.push_back(u);
+      });
+    }
+    std::sort(dag.begin(), dag.end(), [this](int u, int v) { return key_[u] < key_[v]; });
+    for (auto v : dag) {
+      uint64_t count = v == s_ ? 1 : 0;
+      forEachPrev(v, [&](int u) {
+        count = count_[u] > SATURATED - count ? SATURATED : count + count_[u];
+      });
+      count_[v] = count;
+    }
+    return count_[t_];
+  }
+
+  // The cost of the shortest paths.
+  inline int getDist() const { return key_[t_] >> 32; }
+
+  // Set moves to the next shortest path. Return false once all of them
+  // were returned.
+  bool next(std::vector<Vec2>& moves) {
+    if (t_ < 0) return false;
+    if (!started_) {
+      started_ = true;
+      stack_.push_back(Frame { t_, 0 });
+    } else {
+      // Take the next prev of the deepest vertex that has one.
+      for (;;) {
+        stack_.pop_back();
+        if (stack_.empty()) return false;
+        Frame& frame = stack_.back();
+        prevs(frame.v_, prevs_);
+        if (++frame.next_ < static_cast<int>(prevs_.size())) break;
+      }
+    }
+
+    // Descend to the start by the chosen prevs, the first one below.
+    while (stack_.back().v_ != s_) {
+      prevs(stack_.back().v_, prevs_);
+      stack_.push_back(Frame { prevs_[stack_.back().next_], 0 });
+    }
+
+    moves.clear();
+    for (size_t i = stack_.size() - 1; i > 0; --i) {
+      moves.push_back(map_.indexToPos(stack_[i - 1].v_) - map_.indexToPos(stack_[i].v_));
+    }
+    return true;
+  }
+
+ private:
+  // A vertex of the current path, from the end, and the index of its
+  // prev the path goes through.
+  struct Frame {
+    int v_, next_;
+  };
+
+  const KnightMap& map_;
+  StampedSet reached_, onDag_;
+  mutable StampedSet seen_;
+  // Cost << 32 | moves, of the vertices reached.
+  std::vector<int64_t> key_;
+  std::vector<uint64_t> count_;
+  int s_, t_;
+  bool started_;
+  std::vector<Frame> stack_;
+  std::vector<int> prevs_;
+
+  static inline int64_t edgeKey(int weight) { return (int64_t(weight) << 32) + 1; }
+
+  // Dijkstra's algorithm on the keys, until the end is settled. Every
+  // vertex with a smaller key is settled by then, and the others have
+  // tentative keys above the end's, so forEachPrev only finds settled
+  // vertices.
+  bool search(SearchControl& control) {
+    typedef std::pair<int64_t, int> Entry;
+    const std::greater<Entry> later;
+    std::vector<Entry> q;
+    reached_.insert(s_);
+    key_[s_] = 0;
+    q.push_back(Entry(0, s_));
+
+    STATS_PHASE(SEARCH);
+    while (!q.empty()) {
+      std::pop_heap(q.begin(), q.end(), later);
+      const int64_t uKey = q.back().first;
+      const int u = q.back().second;
+      q.pop_back();
+      if (uKey > key_[u]) continue;
+      STATS_COUNT(EXPANDED);
+      control.tick();
+      if (u == t_) return true;
+
+      map_.adj(u, [&](int v) {
+        STATS_COUNT(RELAXED);
+        const int64_t newKey = uKey + edgeKey(map_.edgeWeight(u, v));
+        if (!reached_.contains(v) || newKey < key_[v]) {
+          reached_.insert(v);
+          key_[v] = newKey;
+          q.push_back(Entry(newKey, v));
+          std::push_heap(q.begin(), q.end(), later);
+        }
+      });
+    }
+    return false;
+  }
+
+  // Calls f(u) once for each prev u of DAG vertex v: an edge u -> v
+  // such that key(u) + edge = key(v). A teleport a knight move away
+  // from teleport v is reached by radj twice, by the move and the hop.
+  template <typename F>
+  inline void forEachPrev(int v, F f) const {
+    seen_.reset();
+    map_.radj(v, [&](int u) {
+      if (seen_.contains(u)) return;
+      seen_.insert(u);
+      if (reached_.contains(u) && key_[u] + edgeKey(map_.edgeWeight(u, v)) == key_[v]) f(u);
+    });
+  }
+
+  inline void prevs(int v, std::vector<int>& result) const {
+    result.clear();
+    forEachPrev(v, [&](int u) { result.push_back(u); });
+  }
+
+}; // class ShortestPathDag
+
+// Write the number of shortest paths found by build, with a + if it
+// saturated, then the first limit paths as single query results (with
+// their distance if withDist) separated by empty lines, or the result
+// of a query with no path.
+inline void writeShortestPaths(ShortestPathDag& dag, uint64_t count, int limit, bool withDist,
+                               FdWriter& out) {
+  out.put(std::to_string(count));
+  out.put(count == ShortestPathDag::SATURATED ? "+\n" : "\n");
+  if (count == 0) {
+    writeResult(false, withDist, 0, std::vector<Vec2>(), false, out);
+    return;
+  }
+  std::vector<Vec2> moves;
+  for (int i = 0; i < limit && dag.next(moves); ++i) {
+    if (i > 0) out.put('\n');
+    writeResult(true, withDist, dag.getDist(), moves, false, out);
+  }
+}
+
+#endif // PATH_DAG_H
@@ -0,0 +1,312 @@
+// Reachability queries: the cells a knight reaches within k moves, or
+// within a cost budget on a level 4 map, found by expanding bitsets of
+// whole rows instead of searching cell by cell.
+#ifndef REACH_H
+#define REACH_H
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+
+#include "knight.h"
+#include "knight_map.h"
+#include "output.h"
+#include "control.h"
+
+// A set of cells of a depth x width board, one bit per cell, rows of
+// 64 bit words in row major order whatever the CellLayout. Bits past
+// the width of a row may be set by orShifted, and are cleared by the
+// masks of Reach.
+class BitGrid {
+ public:
+  BitGrid(int depth, int width):
+      depth_(depth), width_(width), words_((width + 63) >> 6), bits_(depth * words_, 0) {}
+
+  inline int getDepth() const { return depth_; }
+
+  inline int getWidth() const { return width_; }
+
+  inline bool get(int x, int y) const { return (row(y)[x >> 6] >> (x & 63)) & 1; }
+
+  inline void set(int x, int y) { row(y)[x >> 6] |= uint64_t(1) << (x & 63); }
+
+  inline uint64_t* row(int y) { return &bits_[y * words_]; }
+
+  inline const uint64_t* row(int y) const { return &bits_[y * words_]; }
+
+  inline void clear() { std::fill(bits_.begin(), bits_.end(), 0); }
+
+  inline bool any() const {
+    for (auto word : bits_) if (word) return true;
+    return false;
+  }
+
+  inline bool intersects(const BitGrid& other) const {
+    for (size_t w = 0; w < bits_.size(); ++w) if (bits_[w] & other.bits_[w]) return true;
+    return false;
+  }
+
+  int count() const {
+    int n = 0;
+    for (auto word : bits_) n += __builtin_popcountll(word);
+    return n;
+  }
+
+  inline BitGrid& operator|=(const BitGrid& other) {
+    for (size_t w = 0; w < bits_.size(); ++w) bits_[w] |= other.bits_[w];
+    return *this;
+  }
+
+  inline BitGrid& operator&=(const BitGrid& other) {
+    for (size_t w = 0; w < bits_.size(); ++w) bits_[w] &= other.bits_[w];
+    return *this;
+  }
+
+  // Remove the cells of other.
+  inline void subtract(const BitGrid& other) {
+    for (size_t w = 0; w < bits_.size(); ++w) bits_[w] &= ~other.bits_[w];
+  }
+
+  // Add the cells of from (restricted to mask, unless null) moved by
+  // dx, dy, with 0 < |dx| < 64. Cells moved off the board are dropped.
+  void orShifted(const BitGrid& from, const BitGrid* mask, int dx, int dy) {
+    for (int y = std::max(0, -dy); y < std::min(depth_, depth_ - dy); ++y) {
+      const uint64_t* s = from.row(y);
+      const uint64_t* m = mask ? mask->row(y) : nullptr;
+      uint64_t* d = row(y + dy);
+      if (dx > 0) {
+        uint64_t carry = 0;
+        for (int w = 0; w < words_; ++w) {
+          const uint64_t word = m ? s[w] & m[w] : s[w];
+          d[w] |= (word << dx) | carry;
+          carry = word >> (64 - dx);
+        }
+      } else {
+        uint64_t carry = 0;
+        for (int w = words_ - 1; w >= 0; --w) {
+          const uint64_t word = m ? s[w] & m[w] : s[w];
+          d[w] |= (word >> -dx) | carry;
+          carry = word << (64 + dx);
+        }
+      }
+    }
+  }
+
+  // Calls f(x, y) for each cell of the set, in row major order.
+  template <typename F>
+  void forEach(F f) const {
+    for (int y = 0; y < depth_; ++y) {
+      const uint64_t* r = row(y);
+      for (int w = 0; w < words_; ++w) {
+        for (uint64_t word = r[w]; word; word &= word - 1) {
+          f((w << 6) + __builtin_ctzll(word), y);
+        }
+      }
+    }
+  }
+
+ private:
+  int depth_, width_, words_;
+  std::vector<uint64_t> bits_;
+
+}; // class BitGrid
+
+// The masks of a board or map for reachability queries: the cells a
+// move may land on, for each knight move the cells it may start from
+// without crossing a BARRIER, and the cells of each edge weight. The
+// moves and weights are those of KnightMap::adj and edgeWeight. A query
+// costs O(k x rows x words) instead of a search of the reached cells.
+class Reach {
+ public:
+  // A board with no obstacle, every edge weighs 1.
+  Reach(int depth, int width):
+      depth_(depth), width_(width), open_(depth, width), teleports_(depth, width) {
+    for (int y = 0; y < depth; ++y) {
+      for (int x = 0; x < width; ++x) open_.set(x, y);
+    }
+    weights_.push_back(Weight { 1, open_ });
+  }
+
+  explicit Reach(const KnightMap& map):
+      depth_(map.getDepth()), width_(map.getWidth()),
+      open_(depth_, width_), teleports_(depth_, width_) {
+    bool hasBarrier = false;
+    for (int y = 0; y < depth_; ++y) {
+      for (int x = 0; x < width_; ++x) {
+        const KnightMap::CellType type = map.getCellType(Vec2(x, y));
+        if (type == KnightMap::BARRIER) hasBarrier = true;
+        if (type == KnightMap::ROCK || type == KnightMap::BARRIER) continue;
+        open_.set(x, y);
+        if (type == KnightMap::TELEPORT) teleports_.set(x, y);
+        weightMask(KnightMap::cellWeight(type)).set(x, y);
+      }
+    }
+
+    // The cell next to u along the long leg of the move, see
+    // KnightMap::isCrossingBarrier. Only moves landing on the board
+    // matter, their middle cells are on the board too.
+    if (!hasBarrier) return;
+    moveFrom_.assign(Knight::N, BitGrid(depth_, width_));
+    for (int i = 0; i < Knight::N; ++i) {
+      for (int y = 0; y < depth_; ++y) {
+        for (int x = 0; x < width_; ++x) {
+          const Vec2 mid(x + Knight::dx(i) / 2, y + Knight::dy(i) / 2);
+          if (!map.isInside(mid) || map.getCellType(mid) != KnightMap::BARRIER) moveFrom_[i].set(x, y);
+        }
+      }
+    }
+  }
+
+  // Return the cells reachable from start in at most k moves, a
+  // teleport hop counting as a move. If heatmap is not null, set it to
+  // the number of moves to each cell, row major, -1 for the cells not
+  // reached. Throws SearchCancelled if control is cancelled or its
+  // deadline passes.
+  BitGrid withinMoves(const Vec2& start, int k, SearchControl& control,
+                      std::vector<int>* heatmap = nullptr) const {
+    BitGrid reached(depth_, width_), frontier(depth_, width_), next(depth_, width_);
+    startAt(start, reached, heatmap);
+    frontier.set(start.x_, start.y_);
+    const bool hasTeleports = teleports_.any();
+    for (int step = 1; step <= k && frontier.any(); ++step) {
+      tickRows(control);
+      next.clear();
+      expand(frontier, next);
+      if (hasTeleports && frontier.intersects(teleports_)) next |= teleports_;
+      next &= open_;
+      next.subtract(reached);
+      reached |= next;
+      record(next, step, heatmap);
+      std::swap(frontier, next);
+    }
+    return reached;
+  }
+
+  // Return the cells reachable from start at a cost of at most budget,
+  // the sum of the edge weights. If heatmap is not null, set it to the
+  // cost of each cell as above. Cells are settled by increasing cost:
+  // the cells of cost c are those of weight w one move away from the
+  // cells of cost c - w, plus every teleport if one of them is among
+  // them or one move away (teleports cost 0). Throws SearchCancelled
+  // as above.
+  BitGrid withinCost(const Vec2& start, int budget, SearchControl& control,
+                     std::vector<int>* heatmap = nullptr) const {
+    BitGrid reached(depth_, width_), layer(depth_, width_);
+    startAt(start, reached, heatmap);
+
+    // The cells one move away from the cells of each cost, the last
+    // MAX_EDGE_WEIGHT + 1 costs.
+    const int ring = KnightMap::MAX_EDGE_WEIGHT + 1;
+    std::vector<BitGrid> moved(ring, BitGrid(depth_, width_));
+    layer.set(start.x_, start.y_);
+    settleTeleports(layer, reached);
+    reached |= layer;
+    record(layer, 0, heatmap);
+    expand(layer, moved[0]);
+
+    const bool hasTeleports = teleports_.any();
+    for (int cost = 1, idle = 0; cost <= budget && idle < ring; ++cost) {
+      tickRows(control);
+      layer.clear();
+      for (auto& weight : weights_) {
+        if (weight.weight_ == 0 || weight.weight_ > cost) continue;
+        BitGrid landed = moved[(cost - weight.weight_) % ring];
+        landed &= weight.cells_;
+        layer |= landed;
+      }
+      layer.subtract(reached);
+      if (hasTeleports) settleTeleports(layer, reached);
+      reached |= layer;
+      record(layer, cost, heatmap);
+
+      BitGrid& next = moved[cost % ring];
+      next.clear();
+      expand(layer, next);
+      idle = layer.any() ? 0 : idle + 1;
+    }
+    return reached;
+  }
+
+  // Write a heatmap in the map format, . for the cells not reached.
+  void writeHeatmap(const std::vector<int>& heatmap, FdWriter& out) const {
+    for (int y = 0; y < depth_; ++y) {
+      for (int x = 0; x < width_; ++x) {
+        if (x > 0) out.put(' ');
+        const int value = heatmap[y * width_ + x];
+        if (value < 0) {
+          out.put('.');
+        } else {
+          out.putInt(value, false);
+        }
+      }
+      out.put('\n');
+    }
+  }
+
+ private:
+  struct Weight {
+    int weight_;
+    BitGrid cells_;
+  };
+
+  int depth_, width_;
+  BitGrid open_, teleports_;
+  std::vector<BitGrid> moveFrom_;
+  std::vector<Weight> weights_;
+
+  BitGrid& weightMask(int weight) {
+    for (auto& w : weights_) if (w.weight_ == weight) return w.cells_;
+    weights_.push_back(Weight { weight, BitGrid(depth_, width_) });
+    return weights_.back().cells_;
+  }
+
+  // A step works on every row, count a tick per row: a step costs
+  // about as much as expanding that many vertices in a search.
+  inline void tickRows(SearchControl& control) const {
+    for (int y = 0; y < depth_; ++y) control.tick();
+  }
+
+  // Add the cells one knight move away from the cells of from to to,
+  // without crossing a BARRIER. to is not masked by open_.
+  inline void expand(const BitGrid& from, BitGrid& to) const {
+    for (int i = 0; i < Knight::N; ++i) {
+      to.orShifted(from, moveFrom_.empty() ? nullptr : &moveFrom_[i], Knight::dx(i), Knight::dy(i));
+    }
+  }
+
+  // Add the teleports not reached yet to layer, the new cells of some
+  // cost, if layer has a teleport or a teleport one move away.
+  void settleTeleports(BitGrid& layer, const BitGrid& reached) const {
+    bool hit = layer.intersects(teleports_);
+    if (!hit) {
+      BitGrid moved(depth_, width_);
+      expand(layer, moved);
+      moved.subtract(reached);
+      hit = moved.intersects(teleports_);
+    }
+    if (!hit) return;
+    BitGrid teleports = teleports_;
+    teleports.subtract(reached);
+    layer |= teleports;
+  }
+
+  void startAt(const Vec2& start, BitGrid& reached, std::vector<int>* heatmap) const {
+    if (start.x_ < 0 || start.x_ >= width_ || start.y_ < 0 || start.y_ >= depth_) {
+      throw std::runtime_error("start out of map.");
+    }
+    reached.set(start.x_, start.y_);
+    if (heatmap) {
+      heatmap->assign(depth_ * width_, -1);
+      (*heatmap)[start.y_ * width_ + start.x_] = 0;
+    }
+  }
+
+  void record(const BitGrid& cells, int value, std::vector<int>* heatmap) const {
+    if (!heatmap) return;
+    cells.forEach([&](int x, int y) { (*heatmap)[y * width_ + x] = value; });
+  }
+
+}; // class Reach
+
+#endif // REACH_H
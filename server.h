@@ -0,0 +1,157 @@
+// A long running server answering solver queries over a Unix domain
+// socket, and the framing shared with the client.
+//
+// Both requests and responses are frames of native int32 values: the
+// number of values n, followed by the n values. A client may send many
+// requests without waiting for the responses, they are answered in
+// order.
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <functional>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "knight.h"
+
+// Answers the request values with the response values. Each connection
+// has its own handler, which keeps its search state between queries.
+typedef std::function<void(const std::vector<int>&, std::vector<int>&)> Handler;
+
+// Append the frame holding values to out.
+inline void appendFrame(const std::vector<int>& values, std::string& out) {
+  const int32_t n = values.size();
+  out.append(reinterpret_cast<const char*>(&n), sizeof(n));
+  for (auto value : values) {
+    const int32_t v = value;
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+  }
+}
+
+// If [p, end) starts with a whole frame, store its values, advance p
+// past it and return true.
+inline bool parseFrame(const char*& p, const char* end, std::vector<int>& values) {
+  int32_t n;
+  if (end - p < static_cast<long>(sizeof(n))) return false;
+  std::memcpy(&n, p, sizeof(n));
+  if (n < 0) throw std::runtime_error("Negative frame size.");
+  if ((end - p) / sizeof(int32_t) < 1 + static_cast<size_t>(n)) return false;
+
+  values.resize(n);
+  for (int i = 0; i < n; ++i) {
+    int32_t v;
+    std::memcpy(&v, p + (1 + i) * sizeof(v), sizeof(v));
+    values[i] = v;
+  }
+  p += (1 + n) * sizeof(int32_t);
+  return true;
+}
+
+// Response values: the distance of the path (the number of moves if
+// all moves cost 1) followed by the x, y of each move, or NO_PATH, or
+// BAD_REQUEST, or TIMEOUT if the search ran past the deadline of the
+// server.
+enum { NO_PATH = -1, BAD_REQUEST = -2, TIMEOUT = -3 };
+
+inline void appendMoves(int dist, const std::vector<Vec2>& moves, std::vector<int>& response) {
+  response.push_back(dist);
+  for (auto move : moves) {
+    response.push_back(move.x_);
+    response.push_back(move.y_);
+  }
+}
+
+// Write all of data to fd. Return false if the peer went away.
+inline bool writeAll(int fd, const std::string& data) {
+  for (size_t done = 0; done < data.size();) {
+    const ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    done += n;
+  }
+  return true;
+}
+
+// Serve one connection until the peer closes it. Requests already
+// received are all answered before the responses are written, so a
+// pipelining client gets them in few writes.
+inline void serveConnection(int fd, Handler handler) {
+  std::string in, out;
+  std::vector<int> request, response;
+  char buffer[1 << 16];
+  for (;;) {
+    const ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n <= 0) break;
+    in.append(buffer, n);
+
+    // Keep a partial frame at the end for the next read.
+    const char* p = in.data();
+    bool broken = false;
+    try {
+      while (parseFrame(p, in.data() + in.size(), request)) {
+        response.clear();
+        try {
+          handler(request, response);
+        } catch (const std::exception&) {
+          // E.g. a board with no cells.
+          response.assign(1, BAD_REQUEST);
+        }
+        appendFrame(response, out);
+      }
+    } catch (const std::exception&) {
+      // A broken frame, the stream can not be resynchronized.
+      broken = true;
+    }
+    in.erase(0, p - in.data());
+
+    if (!writeAll(fd, out) || broken) break;
+    out.clear();
+  }
+  close(fd);
+}
+
+// Listen on the Unix domain socket at path, serving each connection on
+// its own thread with a handler made by makeHandler. Never returns.
+inline void serve(const char* path, std::function<Handler()> makeHandler) {
+  const int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0) throw std::runtime_error("Can not create socket.");
+
+  struct sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (std::strlen(path) >= sizeof(addr.sun_path)) throw std::runtime_error("Socket path too long.");
+  std::strcpy(addr.sun_path, path);
+  unlink(path);
+  if (bind(listenFd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      listen(listenFd, 64) < 0) {
+    throw std::runtime_error(std::string("Can not listen on ") + path + ".");
+  }
+
+  for (;;) {
+    const int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) continue;
+    std::thread(serveConnection, fd, makeHandler()).detach();
+  }
+}
+
+// Connect to the server listening at path. Return the socket.
+inline int connectTo(const char* path) {
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  if (fd < 0 || connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+    throw std::runtime_error(std::string("Can not connect to ") + path + ".");
+  }
+  return fd;
+}
+
+#endif // SERVER_H
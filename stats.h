@@ -0,0 +1,149 @@
+// Opt-in statistics of the searches, to tell where a slow query spends
+// its time. Built with -DKNIGHT_STATS (e.g. make l4.stats), a solver
+// counts the work of its searches, times its phases and, at exit,
+// writes them with its peak RSS as one JSON object to the file named
+// by the KNIGHT_STATS environment variable, or to stderr. Otherwise the
+// STATS_ macros expand to nothing, and the hot loops are unchanged.
+#ifndef STATS_H
+#define STATS_H
+
+// Counters, summed over all threads but MAX_FRONTIER.
+enum StatsCounter {
+  EXPANDED,        // Vertices expanded (popped or entered by a search).
+  RELAXED,         // Edges looked at, in l2 and l3 moves off the board included.
+  PUSHES,          // Priority queue pushes.
+  POPS,            // Priority queue pops, stale entries included.
+  DECREASE_KEYS,   // Pushes lowering the distance of a queued vertex.
+  MAX_FRONTIER,    // Largest queue, or deepest path of a depth first search.
+  DFS_NODES,       // Calls of the level 5 depth first search.
+  PRUNES,          // Subtrees skipped by the level 5 search.
+  TELEPORT_EDGES,  // Teleport edges looked at.
+  COUNTER_COUNT
+};
+
+// Phases, their times are summed over all threads.
+enum StatsPhase { PARSE, BUILD, SEARCH, RECONSTRUCT, PRINT, PHASE_COUNT };
+
+#ifdef KNIGHT_STATS
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+
+#include <sys/resource.h>
+
+struct Stats {
+  uint64_t counts_[COUNTER_COUNT];
+  double seconds_[PHASE_COUNT];
+  Stats(): counts_(), seconds_() {}
+};
+
+// Owns the Stats of every thread, so they outlive the threads, and
+// reports their sum when the program exits.
+class StatsRegistry {
+ public:
+  static StatsRegistry& get() {
+    static StatsRegistry registry;
+    return registry;
+  }
+
+  // The Stats of the calling thread.
+  static inline Stats& local() {
+    static thread_local Stats* stats = nullptr;
+    if (!stats) stats = get().add();
+    return *stats;
+  }
+
+  ~StatsRegistry() {
+    Stats total;
+    for (auto& stats : all_) {
+      for (int i = 0; i < COUNTER_COUNT; ++i) {
+        if (i == MAX_FRONTIER) {
+          total.counts_[i] = std::max(total.counts_[i], stats->counts_[i]);
+        } else {
+          total.counts_[i] += stats->counts_[i];
+        }
+      }
+      for (int i = 0; i < PHASE_COUNT; ++i) total.seconds_[i] += stats->seconds_[i];
+    }
+
+    const char* path = std::getenv("KNIGHT_STATS");
+    std::ofstream file;
+    if (path && *path) file.open(path);
+    write(total, file.is_open() ? file : std::cerr);
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Stats> > all_;
+
+  Stats* add() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    all_.push_back(std::unique_ptr<Stats>(new Stats));
+    return all_.back().get();
+  }
+
+  static void write(const Stats& total, std::ostream& to) {
+    static const char* counterNames[COUNTER_COUNT] = {
+      "expanded", "relaxed", "pushes", "pops", "decreaseKeys", "maxFrontier",
+      "dfsNodes", "prunes", "teleportEdges"
+    };
+    static const char* phaseNames[PHASE_COUNT] = {
+      "parse", "build", "search", "reconstruct", "print"
+    };
+
+    to << "{";
+    for (int i = 0; i < COUNTER_COUNT; ++i) {
+      to << "\"" << counterNames[i] << "\": " << total.counts_[i] << ", ";
+    }
+    to << "\"seconds\": {";
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+      to << (i ? ", " : "") << "\"" << phaseNames[i] << "\": " << total.seconds_[i];
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    to << "}, \"peakRssKb\": " << usage.ru_maxrss << "}\n";
+  }
+
+}; // class StatsRegistry
+
+// Adds the time from its construction to its destruction to a phase.
+class PhaseTimer {
+ public:
+  PhaseTimer(StatsPhase phase): phase_(phase), start_(std::chrono::steady_clock::now()) {}
+
+  ~PhaseTimer() {
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+    StatsRegistry::local().seconds_[phase_] += elapsed.count();
+  }
+
+ private:
+  StatsPhase phase_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#define STATS_ADD(counter, n) (StatsRegistry::local().counts_[counter] += (n))
+#define STATS_MAX(counter, value) \
+  (StatsRegistry::local().counts_[counter] = \
+       std::max<uint64_t>(StatsRegistry::local().counts_[counter], (value)))
+#define STATS_CONCAT_(a, b) a##b
+#define STATS_CONCAT(a, b) STATS_CONCAT_(a, b)
+// Time the rest of the enclosing scope as phase.
+#define STATS_PHASE(phase) PhaseTimer STATS_CONCAT(phaseTimer, __LINE__)(phase)
+
+#else
+
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_MAX(counter, value) ((void)0)
+#define STATS_PHASE(phase) ((void)0)
+
+#endif // KNIGHT_STATS
+
+#define STATS_COUNT(counter) STATS_ADD(counter, 1)
+
+#endif // STATS_H
@@ -0,0 +1,279 @@
+// Out-of-core storage of a level 4 map and of the state of searches on
+// it, for maps larger than memory.
+#ifndef TILE_FILE_H
+#define TILE_FILE_H
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "knight.h"
+#include "knight_map.h"
+
+// A map stored in a temporary file of TILE x TILE tiles, padding
+// included as in Board, each tile holding the cell types and the search
+// state (stamp, distance and prev) of its cells. Only the tiles in use
+// are mapped, at most as many as fit in the memory budget, the least
+// recently used one is unmapped first. Indices are 64 bit: the tile
+// number times AREA plus the offset of the cell in the tile.
+//
+// The search state is stamped like a StampedSet, so a new search costs
+// O(1) and does not rewrite the file.
+class TileFile {
+ public:
+  typedef int64_t Index;
+  typedef KnightMap::CellType CellType;
+  static const int SHIFT = 6, TILE = 1 << SHIFT, MASK = TILE - 1, AREA = TILE * TILE;
+  static const int PAD = Board::PAD;
+
+  // Prev of a cell with no prev cell. Otherwise prev is the index of the
+  // knight move reaching the cell, or Knight::N plus the number of the
+  // teleport it was reached from.
+  static const int NO_PREV = -1;
+
+  // Read the map from `from` into a new tile file in the directory
+  // TMPDIR (or /tmp), mapping at most budget bytes of tiles. The map is
+  // read row by row, only a row of tiles is kept in memory.
+  TileFile(std::istream& from, size_t budget):
+      depth_(0), width_(0), generation_(1), lastId_(-1), last_(nullptr) {
+    const char* dir = std::getenv("TMPDIR");
+    std::string path = std::string(dir && *dir ? dir : "/tmp") + "/knight-tiles-XXXXXX";
+    fd_ = mkstemp(&path[0]);
+    if (fd_ < 0) throw std::runtime_error("Can not create tile file in " + path + ".");
+    // Removed when closed.
+    unlink(path.c_str());
+
+    capacity_ = std::max<size_t>(budget / RECORD, 16);
+    read(from);
+  }
+
+  ~TileFile() {
+    for (auto& tile : lru_) munmap(tile.data_, RECORD);
+    close(fd_);
+  }
+
+  inline int getDepth() const { return depth_; }
+
+  inline int getWidth() const { return width_; }
+
+  inline bool isInside(const Vec2& pos) const {
+    return pos.x_ >= 0 && pos.x_ < width_ && pos.y_ >= 0 && pos.y_ < depth_;
+  }
+
+  inline Index posToIndex(const Vec2& u) const { return index(u.x_ + PAD, u.y_ + PAD); }
+
+  inline Vec2 indexToPos(Index i) const {
+    const Index tile = i / AREA;
+    const int offset = i % AREA;
+    return Vec2((tile % tilesPerRow_) * TILE + (offset & MASK) - PAD,
+                (tile / tilesPerRow_) * TILE + (offset >> SHIFT) - PAD);
+  }
+
+  // Return the index of the cell dx, dy away from cell i. The shifts
+  // of negative tile coordinates round down, as g++ and clang do.
+  inline Index shift(Index i, int dx, int dy) const {
+    const int offset = i % AREA;
+    const int x = (offset & MASK) + dx, y = (offset >> SHIFT) + dy;
+    return (i / AREA + static_cast<Index>(y >> SHIFT) * tilesPerRow_ + (x >> SHIFT)) * AREA +
+           ((y & MASK) << SHIFT) + (x & MASK);
+  }
+
+  inline CellType getCellType(Index i) {
+    return static_cast<CellType>(tile(i / AREA)[CELLS + i % AREA]);
+  }
+
+  // The teleports, in increasing index order.
+  inline const std::vector<Index>& getTeleports() const { return teleports_; }
+
+  // Start a new search: no cell has a distance.
+  inline void reset() {
+    if (++generation_ == 0) throw std::runtime_error("Too many searches on a tile file.");
+  }
+
+  // Return the distance of cell i, -1 means infinity.
+  inline int getDist(Index i) {
+    char* data = tile(i / AREA);
+    const int offset = i % AREA;
+    return field(data, STAMPS, offset) == generation_ ? field(data, DISTS, offset) : -1;
+  }
+
+  inline void setDist(Index i, int d) {
+    char* data = tile(i / AREA);
+    const int offset = i % AREA;
+    field(data, STAMPS, offset) = generation_;
+    field(data, DISTS, offset) = d;
+  }
+
+  // Return the prev of cell i, which must have a distance.
+  inline int getPrev(Index i) { return field(tile(i / AREA), PREVS, i % AREA); }
+
+  inline void setPrev(Index i, int prev) { field(tile(i / AREA), PREVS, i % AREA) = prev; }
+
+  // Return the cell cell i was reached from with prev.
+  inline Index prevIndex(Index i, int prev) const {
+    if (prev < Knight::N) return shift(i, -Knight::dx(prev), -Knight::dy(prev));
+    return teleports_[prev - Knight::N];
+  }
+
+  // Calls f(v, prev) for each cell v that can be reached from cell u,
+  // with the prev of v if reached from u. Same rules as KnightMap::adj.
+  template <typename F>
+  inline void adj(Index u, F f) {
+    for (int i = 0; i < Knight::N; ++i) {
+      const Index v = shift(u, Knight::dx(i), Knight::dy(i));
+      const CellType type = getCellType(v);
+      if (type == KnightMap::ROCK || type == KnightMap::BARRIER) continue;
+
+      // The cell next to u along the long leg of the move, see
+      // KnightMap::isCrossingBarrier.
+      if (getCellType(shift(u, Knight::dx(i) / 2, Knight::dy(i) / 2)) == KnightMap::BARRIER) continue;
+      f(v, i);
+    }
+
+    if (getCellType(u) == KnightMap::TELEPORT) {
+      const int self = std::lower_bound(teleports_.begin(), teleports_.end(), u) - teleports_.begin();
+      for (size_t k = 0; k < teleports_.size(); ++k) {
+        if (static_cast<int>(k) != self) f(teleports_[k], Knight::N + self);
+      }
+    }
+  }
+
+ private:
+  // The parts of a tile, a multiple of the page size each.
+  static const int CELLS = 0, STAMPS = AREA, DISTS = 5 * AREA, PREVS = 9 * AREA;
+  static const int RECORD = 13 * AREA;
+
+  struct Mapped {
+    Index id_;
+    char* data_;
+  };
+
+  int fd_;
+  int depth_, width_;
+  Index tilesPerRow_;
+  std::vector<Index> teleports_;
+  unsigned generation_;
+
+  size_t capacity_;
+  std::list<Mapped> lru_;
+  std::unordered_map<Index, std::list<Mapped>::iterator> mapped_;
+  Index lastId_;
+  char* last_;
+
+  inline Index index(int x, int y) const {
+    return ((y >> SHIFT) * tilesPerRow_ + (x >> SHIFT)) * AREA + ((y & MASK) << SHIFT) + (x & MASK);
+  }
+
+  static inline uint32_t& field(char* data, int part, int offset) {
+    return reinterpret_cast<uint32_t*>(data + part)[offset];
+  }
+
+  // Return the record of tile id, mapping it if needed.
+  char* tile(Index id) {
+    if (id == lastId_) return last_;
+
+    auto it = mapped_.find(id);
+    if (it != mapped_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second);
+    } else {
+      if (lru_.size() >= capacity_) {
+        // Dirty pages are written back by the kernel.
+        munmap(lru_.back().data_, RECORD);
+        mapped_.erase(lru_.back().id_);
+        lru_.pop_back();
+      }
+      void* data = mmap(nullptr, RECORD, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, id * RECORD);
+      if (data == MAP_FAILED) throw std::runtime_error("Can not map tile.");
+      lru_.push_front(Mapped { id, static_cast<char*>(data) });
+      mapped_[id] = lru_.begin();
+    }
+    lastId_ = id;
+    last_ = lru_.front().data_;
+    return last_;
+  }
+
+  // Read the map a row of tiles at a time, writing the cell types of
+  // each tile row to the file when it is complete. The search state is
+  // left as holes of the file, which read as zero stamps.
+  void read(std::istream& from) {
+    std::vector<char> rows;
+    std::string line;
+    std::ostringstream oss;
+    int y = 0;
+    Index tileRow = 0;
+    for (bool more = true; more;) {
+      more = static_cast<bool>(std::getline(from, line));
+      if (more) {
+        std::stringstream iss(line);
+        std::vector<char> cells;
+        char c;
+        while (iss >> c) cells.push_back(KnightMap::parseCell(c));
+
+        // First row, do not check width, set it.
+        if (y == 0) {
+          width_ = cells.size();
+          if (width_ == 0) throw std::runtime_error("Board.width_ must > 0");
+          tilesPerRow_ = (width_ + 2 * PAD + MASK) >> SHIFT;
+          rows.assign(static_cast<size_t>(TILE) * tilesPerRow_ * TILE, KnightMap::ROCK);
+        }
+        if (static_cast<int>(cells.size()) != width_) {
+          oss << "At row " << y << ", width is " << cells.size() << ", ";
+          oss << "but previous row width is " << width_ << ".";
+          throw std::runtime_error(oss.str());
+        }
+
+        char* row = &rows[static_cast<size_t>((y + PAD) & MASK) * tilesPerRow_ * TILE];
+        for (int x = 0; x < width_; ++x) {
+          row[x + PAD] = cells[x];
+          if (cells[x] == KnightMap::TELEPORT) teleports_.push_back(posToIndexOf(x, y));
+        }
+        ++y;
+      } else {
+        depth_ = y;
+        if (depth_ == 0) throw std::runtime_error("Board.depth_ must > 0");
+      }
+
+      // Write the tile rows above the next row, or all of them at the
+      // end of the map.
+      const Index nextTileRow = more ? (y + PAD) >> SHIFT : (depth_ + 2 * PAD + MASK) >> SHIFT;
+      for (; tileRow < nextTileRow; ++tileRow) {
+        writeTileRow(tileRow, rows);
+        std::fill(rows.begin(), rows.end(), KnightMap::ROCK);
+      }
+    }
+    if (ftruncate(fd_, tileRow * tilesPerRow_ * RECORD) < 0) {
+      throw std::runtime_error("Can not grow tile file.");
+    }
+    std::sort(teleports_.begin(), teleports_.end());
+  }
+
+  inline Index posToIndexOf(int x, int y) const { return index(x + PAD, y + PAD); }
+
+  void writeTileRow(Index tileRow, const std::vector<char>& rows) {
+    std::vector<char> cells(AREA);
+    const size_t rowSize = static_cast<size_t>(tilesPerRow_) * TILE;
+    for (Index tx = 0; tx < tilesPerRow_; ++tx) {
+      for (int ty = 0; ty < TILE; ++ty) {
+        std::memcpy(&cells[ty * TILE], &rows[ty * rowSize + tx * TILE], TILE);
+      }
+      const Index id = tileRow * tilesPerRow_ + tx;
+      if (pwrite(fd_, cells.data(), AREA, id * RECORD + CELLS) != AREA) {
+        throw std::runtime_error("Can not write tile file.");
+      }
+    }
+  }
+
+}; // class TileFile
+
+#endif // TILE_FILE_H